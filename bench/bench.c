@@ -0,0 +1,323 @@
+//******************************************************************************
+//*                                                                            *
+//* BENCH.C                                                                    *
+//*                                                                            *
+//* MICROBENCHMARKS OF THE SOLVER KERNELS, ON INITIAL OR RESTART DATA          *
+//*                                                                            *
+//******************************************************************************
+
+// Built with "make bench PROB=...", in place of main.c.  Runs on one process:
+//   ./harm_bench -p param.dat [-r restarts/restart_00000241.h5] [-n reps]
+// Without -r the kernels run on the problem's initial conditions.  The grid is
+// the compiled one, so build with the restart's NiTOT, or with RESTART_REGRID
+// to move a production restart onto a smaller grid.
+// Each kernel sweeps the whole block once per repetition, after an untimed
+// warm-up, and is reported as ns per zone (best and mean) and zones/s, to
+// stdout and bench_kernels.json
+
+// import headers
+#include "decs.h"
+#include "defs.h"
+#include "positrons.h"
+
+#if N1CPU*N2CPU*N3CPU > 1
+#error "Kernel benchmarks run on one process, set NiCPU to 1"
+#endif
+
+// Kernels not otherwise exported
+void lr_to_flux(struct GridGeom *G, struct FluidState *Sl,
+  struct FluidState *Sr, int dir, int loc, GridPrim *flux, GridVector *ctop);
+void linear_mc(double unused1, double x1, double x2, double x3, double unused2, double *lout, double *rout);
+void ppm(double x1, double x2, double x3, double x4, double x5, double *lout, double *rout);
+void ppmx(double x1, double x2, double x3, double x4, double x5, double *lout, double *rout);
+void weno(double x1, double x2, double x3, double x4, double x5, double *lout, double *rout);
+void weno_z(double x1, double x2, double x3, double x4, double x5, double *lout, double *rout);
+void mp5(double x1, double x2, double x3, double x4, double x5, double *lout, double *rout);
+
+// State shared by the kernels: the initial state S0, the state one step on
+// S1, and working copies
+static struct GridGeom *G;
+static struct FluidState *S0, *S1, *S, *Sl, *Sr;
+static struct FluidFlux *F, *F0;
+static GridVector *ctop;
+static GridDouble *cmax, *cmin;
+
+//******************************************************************************
+
+// Sweep one algorithm in X1 over all prims, as reconstruct() does
+typedef void (*recon_func)(double, double, double, double, double, double *, double *);
+static recon_func recon_algo;
+static void bench_recon_algo()
+{
+#pragma omp parallel for collapse(3)
+  PLOOP {
+    KSLOOP(-1, N3) {
+      JSLOOP(-1, N2) {
+        ISLOOP(-1, N1) {
+          recon_algo(S->P[ip][k][j][i-2], S->P[ip][k][j][i-1], S->P[ip][k][j][i],
+                     S->P[ip][k][j][i+1], S->P[ip][k][j][i+2], &(Sl->P[ip][k][j][i]),
+                     &(Sr->P[ip][k][j][i]));
+        }
+      }
+    }
+  }
+}
+
+static void bench_reconstruct()
+{
+  reconstruct(S, Sl->P, Sr->P, 1);
+}
+
+static void bench_lr_to_flux()
+{
+  lr_to_flux(G, Sl, Sr, 1, FACE1, &(F->X1), ctop);
+}
+
+static void bench_get_state_vec()
+{
+  get_state_vec(G, S, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+}
+
+static void bench_mhd_vchar()
+{
+#pragma omp parallel for collapse(3)
+  ZLOOP mhd_vchar(G, S, i, j, k, CENT, 1, *cmax, *cmin);
+}
+
+// Conserved variables one step on, from the old primitives, as in step()
+static void reset_u_to_p()
+{
+  memcpy(&(S->P), &(S0->P), sizeof(GridPrim));
+  memcpy(&(S->U), &(S1->U), sizeof(GridPrim));
+}
+
+static void bench_u_to_p()
+{
+#pragma omp parallel for collapse(3)
+  ZLOOP pflag[k][j][i] = U_to_P(G, S, i, j, k, CENT);
+}
+
+static void reset_fixup()
+{
+  memcpy(&(S->P), &(S1->P), sizeof(GridPrim));
+}
+
+static void bench_fixup()
+{
+  fixup(G, S);
+}
+
+static void reset_flux_ct()
+{
+  memcpy(F, F0, sizeof(struct FluidFlux));
+}
+
+static void bench_flux_ct()
+{
+  flux_ct(F);
+}
+
+#if COOLING
+static void bench_rad_cooling()
+{
+  rad_cooling(G, S0, S, dt);
+}
+#endif
+
+#if POSITRONS
+static void bench_pair_production()
+{
+  pair_production(G, S0, S, dt);
+}
+#endif
+
+//******************************************************************************
+
+struct Kernel {
+  const char *name;
+  void (*run)();
+  void (*reset)();
+  recon_func algo;
+};
+
+static const struct Kernel kernels[] = {
+  {"recon_linear_mc", bench_recon_algo, NULL, linear_mc},
+  {"recon_ppm", bench_recon_algo, NULL, ppm},
+  {"recon_ppmx", bench_recon_algo, NULL, ppmx},
+  {"recon_weno", bench_recon_algo, NULL, weno},
+  {"recon_weno_z", bench_recon_algo, NULL, weno_z},
+  {"recon_mp5", bench_recon_algo, NULL, mp5},
+  {"reconstruct", bench_reconstruct, NULL, NULL},
+  {"lr_to_flux", bench_lr_to_flux, NULL, NULL},
+  {"get_state_vec", bench_get_state_vec, NULL, NULL},
+  {"mhd_vchar", bench_mhd_vchar, NULL, NULL},
+  {"u_to_p", bench_u_to_p, reset_u_to_p, NULL},
+  {"fixup", bench_fixup, reset_fixup, NULL},
+  {"flux_ct", bench_flux_ct, reset_flux_ct, NULL},
+#if COOLING
+  {"rad_cooling", bench_rad_cooling, reset_fixup, NULL},
+#endif
+#if POSITRONS
+  {"pair_production", bench_pair_production, reset_fixup, NULL},
+#endif
+};
+#define NKERNEL ((int) (sizeof(kernels)/sizeof(kernels[0])))
+
+//******************************************************************************
+
+int main(int argc, char *argv[])
+{
+  mpi_initialization(argc, argv);
+
+  // Read command line arguments, parameter files
+  char pfname[STRLEN] = "param.dat";
+  char rfname[STRLEN] = "";
+  int reps = 10;
+  for (int n = 0; n < argc; n++) {
+    if (*argv[n] == '-' && *(argv[n]+1) != '\0' && *(argv[n]+2) == '\0' &&
+        n < argc-1) {
+      if (*(argv[n]+1) == 'p') { // Set parameter file path
+        strcpy(pfname, argv[++n]);
+      }
+      if (*(argv[n]+1) == 'r') { // Restart file to take the state from
+        strcpy(rfname, argv[++n]);
+      }
+      if (*(argv[n]+1) == 'n') { // Timed repetitions of each kernel
+        reps = atoi(argv[++n]);
+      }
+    }
+  }
+  reps = MY_MAX(reps, 1);
+
+  set_core_params();
+  set_problem_params();
+  read_params(pfname);
+
+  //get number of threads
+  #pragma omp parallel
+  {
+    #pragma omp master
+    {
+      nthreads = omp_get_num_threads();
+    }
+  }
+  omp_set_num_threads(OMP_CORES);
+
+  G = calloc(1,sizeof(struct GridGeom));
+  S0 = calloc(1,sizeof(struct FluidState));
+  S1 = calloc(1,sizeof(struct FluidState));
+  S = calloc(1,sizeof(struct FluidState));
+  Sl = calloc(1,sizeof(struct FluidState));
+  Sr = calloc(1,sizeof(struct FluidState));
+  F = calloc(1,sizeof(struct FluidFlux));
+  F0 = calloc(1,sizeof(struct FluidFlux));
+  ctop = calloc(1,sizeof(GridVector));
+  cmax = calloc(1,sizeof(GridDouble));
+  cmin = calloc(1,sizeof(GridDouble));
+
+  double z1 = 1 + pow(1 - a*a,1./3.)*(pow(1+a,1./3.) + pow(1-a,1./3.));
+  double z2 = sqrt(3*a*a + z1*z1);
+  R_isco = 3 + z2 - sqrt((3-z1)*(3 + z1 + 2*z2));
+
+  // Initial state, from the restart if any, as restart_init() sets it up
+  if (rfname[0] != '\0') {
+    zero_arrays();
+    if (!restart_read(rfname, S0)) {
+      fprintf(stderr, "Restart file %s fails its checksum!\n", rfname);
+      exit(-1);
+    }
+    set_grid(G);
+    get_state_vec(G, S0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+    prim_to_flux_vec(G, S0, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, S0->U);
+    set_bounds(G, S0);
+  } else {
+    init(G, S0);
+    nstep = 0;
+    t = 0;
+    zero_arrays();
+    get_state_vec(G, S0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+  }
+
+#if POSITRONS && INIT_PAIRS
+  if (rfname[0] == '\0') init_positrons(G, S0);
+#endif
+#if COOLING
+  init_cooling(G);
+#endif
+#if POSITRONS
+  set_units();
+#endif
+
+  // One real step gives the inputs for U_to_P, the fixups and sources
+  memcpy(S1, S0, sizeof(struct FluidState));
+  step(G, S1);
+  get_state_vec(G, S1, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+  prim_to_flux_vec(G, S1, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, S1->U);
+
+  // Fluxes from the initial state, for flux_ct
+  memcpy(S, S0, sizeof(struct FluidState));
+  get_flux(G, S, F0);
+  memcpy(F, F0, sizeof(struct FluidFlux));
+  reconstruct(S, Sl->P, Sr->P, 1);
+
+  time_init();
+
+  double zones = (double) N1*N2*N3;
+  double best[NKERNEL], mean[NKERNEL];
+  for (int n = 0; n < NKERNEL; n++) {
+    recon_algo = kernels[n].algo;
+    best[n] = 1.e100;
+    mean[n] = 0.;
+
+    // Untimed warm-up, then the repetitions
+    for (int r = -1; r < reps; r++) {
+      if (kernels[n].reset != NULL) kernels[n].reset();
+      double start = omp_get_wtime();
+      kernels[n].run();
+      double elapsed = omp_get_wtime() - start;
+      if (r < 0) continue;
+      best[n] = MY_MIN(best[n], elapsed);
+      mean[n] += elapsed/reps;
+    }
+
+    // Leave the reconstruction and states as lr_to_flux and mhd_vchar expect
+    if (kernels[n].algo != NULL) reconstruct(S, Sl->P, Sr->P, 1);
+    if (kernels[n].reset != NULL) memcpy(S, S0, sizeof(struct FluidState));
+    get_state_vec(G, S, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+  }
+
+#ifdef PROB_NAME
+  const char *problem = QUOTE(PROB_NAME);
+#else
+  const char *problem = "unknown";
+#endif
+
+  fprintf(stdout, "\n********** KERNELS: %s, %dx%dx%d, %d threads, %d reps **********\n",
+          (rfname[0] != '\0') ? rfname : "initial conditions", N1TOT, N2TOT, N3TOT, nthreads, reps);
+  fprintf(stdout, "   %-18s %12s %12s %12s\n", "", "NS/ZONE", "MEAN", "ZONES/S");
+
+  FILE *fp = fopen("bench_kernels.json", "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Could not write bench_kernels.json!\n");
+    exit(-1);
+  }
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"problem\": \"%s\",\n", problem);
+  fprintf(fp, "  \"git_version\": \"%s\",\n", QUOTE(GIT_VERSION));
+  fprintf(fp, "  \"source\": \"%s\",\n", (rfname[0] != '\0') ? rfname : "init");
+  fprintf(fp, "  \"n1tot\": %d, \"n2tot\": %d, \"n3tot\": %d,\n", N1TOT, N2TOT, N3TOT);
+  fprintf(fp, "  \"nthreads\": %d,\n", nthreads);
+  fprintf(fp, "  \"reps\": %d,\n", reps);
+  fprintf(fp, "  \"kernels\": {");
+  for (int n = 0; n < NKERNEL; n++) {
+    fprintf(stdout, "   %-18s %12.4g %12.4g %12.4g\n", kernels[n].name,
+            1.e9*best[n]/zones, 1.e9*mean[n]/zones, zones/best[n]);
+    fprintf(fp, "%s\n    \"%s\": {\"ns_per_zone\": %.6g, \"ns_per_zone_mean\": %.6g, \"zones_per_s\": %.6g}",
+            (n > 0) ? "," : "", kernels[n].name, 1.e9*best[n]/zones, 1.e9*mean[n]/zones, zones/best[n]);
+  }
+  fprintf(fp, "\n  }\n}\n");
+  fclose(fp);
+
+  mpi_finalize();
+  return 0;
+}
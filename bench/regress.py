@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+
+################################################################################
+#                                                                              #
+#  PERFORMANCE REGRESSION CHECK                                                #
+#                                                                              #
+################################################################################
+
+# Builds each problem at a fixed small size, times a few steps with harm -b,
+# and compares zone-cycles/s and the per-step time of each timer against a
+# stored baseline.  Exits 1 on any regression beyond the tolerances, 2 if a
+# build or run fails.
+#
+#   bench/regress.py --save           # record a baseline on this machine
+#   bench/regress.py                  # compare against it
+#
+# Baselines only mean something on the machine and build flags they were taken
+# with, so keep one per machine, e.g. --baseline baseline_$(hostname).json.
+# Make variables for the build go after --make, e.g.
+#   bench/regress.py --make CC=mpicc HDF5_DIR=/usr/lib/hdf5
+
+import argparse
+import json
+import os
+import re
+import shutil
+import socket
+import subprocess
+import sys
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Fixed short configurations: grid, steps, the parameter file to start from, and
+# flags in decs.h to change.  Pair production and cooling would dominate every
+# step, so they are timed by the pairs problem alone
+NO_PAIRS = {"POSITRONS": 0, "COOLING": 0}
+CONFIGS = {
+    "sod":      {"n": (1000, 1, 1), "steps": 200, "param": "param.dat", "flags": NO_PAIRS},
+    "bondi":    {"n": (128, 64, 1), "steps": 20, "param": "param.dat", "flags": NO_PAIRS},
+    "torus":    {"n": (128, 64, 1), "steps": 10, "param": "param_sane.dat", "flags": NO_PAIRS},
+    "pairs":    {"n": (64, 32, 1), "steps": 2, "param": "param_sane.dat", "flags": {}},
+    "thindisk": {"n": (128, 64, 1), "steps": 10, "param": "param.dat", "flags": NO_PAIRS},
+}
+
+
+def configure(prob, work, cfg):
+    """Set up work/prob/build_archive with the problem's parameters.h at the fixed size"""
+    pdir = os.path.join(work, prob)
+    arc = os.path.join(pdir, "build_archive")
+    os.makedirs(arc, exist_ok=True)
+
+    # The makefile keeps archive files newer than the sources, so edit a fresh copy
+    with open(os.path.join(REPO, "prob", prob, "parameters.h")) as f:
+        params = f.read()
+    for d, n in zip((1, 2, 3), cfg["n"]):
+        params = re.sub(r"#define N%dTOT .*" % d, "#define N%dTOT %d" % (d, n), params)
+        params = re.sub(r"#define N%dCPU .*" % d, "#define N%dCPU 1" % d, params)
+    with open(os.path.join(arc, "parameters.h"), "w") as f:
+        f.write(params)
+
+    with open(os.path.join(REPO, "core", "decs.h")) as f:
+        decs = f.read()
+    for flag, val in cfg["flags"].items():
+        decs = re.sub(r"#define %s .*" % flag, "#define %s %d" % (flag, val), decs)
+    with open(os.path.join(arc, "decs.h"), "w") as f:
+        f.write(decs)
+
+    shutil.copy(os.path.join(REPO, "prob", prob, cfg["param"]), os.path.join(pdir, "param.dat"))
+    return pdir
+
+
+def run_problem(prob, args):
+    """Build and time one problem, returning its benchmark.json, or None on failure"""
+    cfg = CONFIGS[prob]
+    pdir = configure(prob, args.work, cfg)
+
+    make = ["make", "-f", os.path.join(REPO, "makefile"), "PROB=" + prob] + args.make
+    build = subprocess.run(make, cwd=pdir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                           universal_newlines=True)
+    if build.returncode != 0:
+        print("Build of {} failed:\n{}".format(prob, build.stdout[-2000:]))
+        return None
+
+    # Best of the repeats, each from a clean table
+    best = None
+    for _ in range(args.repeat):
+        for f in ("benchmark.json", "benchmark.csv"):
+            if os.path.exists(os.path.join(pdir, f)):
+                os.remove(os.path.join(pdir, f))
+        cmd = args.launch.split() + ["./harm", "-p", "param.dat", "-b", str(cfg["steps"])]
+        log = open(os.path.join(pdir, "regress.log"), "w")
+        run = subprocess.run(cmd, cwd=pdir, stdout=log, stderr=subprocess.STDOUT)
+        log.close()
+        if run.returncode != 0 or not os.path.exists(os.path.join(pdir, "benchmark.json")):
+            print("Run of {} failed, see {}".format(prob, os.path.join(pdir, "regress.log")))
+            return None
+        with open(os.path.join(pdir, "benchmark.json")) as f:
+            result = json.load(f)
+        if best is None or result["zcps"] > best["zcps"]:
+            best = result
+
+    return {"n": list(cfg["n"]), "steps": cfg["steps"], "flags": cfg["flags"], "nthreads": best["nthreads"],
+            "git_version": best["git_version"], "zcps": best["zcps"],
+            "timers": {name: t["mean"] for name, t in best["timers"].items()}}
+
+
+def compare(prob, new, old, args):
+    """Print the comparison for one problem, returning the list of regressions"""
+    if old is None:
+        print("{:10s} {:12.4g} zcps, no baseline".format(prob, new["zcps"]))
+        return []
+    if any(old.get(key) != new[key] for key in ("n", "steps", "flags", "nthreads")):
+        print("{:10s} configuration differs from the baseline, skipping".format(prob))
+        return []
+
+    failures = []
+    ratio = new["zcps"]/old["zcps"]
+    flag = ""
+    if ratio < 1. - args.tolerance:
+        failures.append("{}: zcps {:.4g} vs {:.4g}".format(prob, new["zcps"], old["zcps"]))
+        flag = "  REGRESSION"
+    print("{:10s} {:12.4g} zcps, baseline {:12.4g} ({:+.1f}%){}".format(
+        prob, new["zcps"], old["zcps"], 100.*(ratio - 1.), flag))
+
+    # Phases, where they are a noticeable part of the step
+    total = old["timers"].get("all", 0.)
+    for name, t_old in sorted(old["timers"].items()):
+        t_new = new["timers"].get(name)
+        if name == "all" or t_new is None or total <= 0. or t_old < args.min_fraction*total:
+            continue
+        change = t_new/t_old - 1.
+        flag = ""
+        if change > args.phase_tolerance:
+            failures.append("{}/{}: {:.4g} s vs {:.4g} s per step".format(prob, name, t_new, t_old))
+            flag = "  REGRESSION"
+        print("  {:14s} {:12.4g} s  baseline {:12.4g} s ({:+.1f}%){}".format(
+            name, t_new, t_old, 100.*change, flag))
+
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check performance against a stored baseline")
+    parser.add_argument("--problems", default=",".join(CONFIGS),
+                        help="comma-separated problems to run, from " + ", ".join(CONFIGS))
+    parser.add_argument("--baseline", default=os.path.join(REPO, "bench", "baseline.json"),
+                        help="baseline file to compare against or save to")
+    parser.add_argument("--save", action="store_true", help="store the results as the baseline")
+    parser.add_argument("--tolerance", type=float, default=0.1,
+                        help="allowed fractional loss of zone-cycles/s")
+    parser.add_argument("--phase-tolerance", type=float, default=0.25,
+                        help="allowed fractional growth of each timer")
+    parser.add_argument("--min-fraction", type=float, default=0.05,
+                        help="only check timers taking at least this fraction of a step")
+    parser.add_argument("--repeat", type=int, default=3, help="runs per problem, keeping the fastest")
+    parser.add_argument("--work", default="regress", help="directory to build and run in")
+    parser.add_argument("--launch", default="", help="launcher for harm, e.g. 'mpirun -np 1'")
+    parser.add_argument("--make", nargs=argparse.REMAINDER, default=[],
+                        help="variables for make, e.g. CC=mpicc")
+    args = parser.parse_args()
+    args.work = os.path.abspath(args.work)
+
+    problems = [p for p in args.problems.split(",") if p]
+    for p in problems:
+        if p not in CONFIGS:
+            parser.error("no configuration for problem " + p)
+
+    baseline = {"problems": {}}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if not args.save and baseline.get("host") != socket.gethostname():
+            print("Baseline was taken on {}, this is {}".format(baseline.get("host"), socket.gethostname()))
+
+    results = {}
+    for p in problems:
+        print("Running " + p, flush=True)
+        results[p] = run_problem(p, args)
+    if any(r is None for r in results.values()):
+        sys.exit(2)
+
+    if args.save:
+        baseline["host"] = socket.gethostname()
+        baseline["problems"].update(results)
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2)
+        print("Saved baseline for {} to {}".format(", ".join(problems), args.baseline))
+        return
+
+    print()
+    failures = []
+    for p in problems:
+        failures += compare(p, results[p], baseline["problems"].get(p), args)
+
+    if failures:
+        print("\nPERFORMANCE REGRESSIONS:")
+        for f in failures:
+            print("  " + f)
+        sys.exit(1)
+    print("\nNo regressions")
+
+
+if __name__ == "__main__":
+    main()
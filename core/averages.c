@@ -0,0 +1,124 @@
+//******************************************************************************
+//*                                                                            *
+//* AVERAGES.C                                                                 *
+//*                                                                            *
+//* IN-SITU X3- AND TIME-AVERAGED PROFILES                                     *
+//*                                                                            *
+//******************************************************************************
+
+// import headers
+#include "decs.h"
+#include "hdf5_utils.h"
+
+#if AVERAGES
+
+// Averaged quantities.  Vector components are in code coordinates, like jcon
+static const char *avg_names[NAVG] = {"rho", "u", "bsq", "beta_inv", "ucon1", "T1_0"};
+
+// Running sums over x3 and time, weighted by the time since the previous sample
+static double (*avg_sum)[N2][N1];
+static double avg_t0, avg_tlast;
+
+//******************************************************************************
+
+// Open the first averaging window at the current time
+void average_init()
+{
+  avg_sum = calloc_tracked(NAVG, sizeof(*avg_sum), "averages");
+  avg_t0 = avg_tlast = t;
+}
+
+//******************************************************************************
+
+// Add the current state to the sums.  Called after each step, samples every
+// AVG_CADENCE steps, and once more whenever the window is closed
+static void average_sample(struct GridGeom *G, struct FluidState *S)
+{
+  double w = t - avg_tlast;
+  if (w <= 0.) return;
+
+#pragma omp parallel for collapse(2)
+  JLOOP {
+    ILOOP {
+      double sum[NAVG] = {0};
+      KLOOP {
+        get_state(G, S, i, j, k, CENT);
+        double mhd[NDIM];
+        mhd_calc(S, i, j, k, 1, mhd);
+        double bsq = bsq_calc(S, i, j, k);
+        sum[0] += S->P[RHO][k][j][i];
+        sum[1] += S->P[UU][k][j][i];
+        sum[2] += bsq;
+        sum[3] += bsq/(2.*(gam - 1.)*S->P[UU][k][j][i]);
+        sum[4] += S->ucon[1][k][j][i];
+        sum[5] += mhd[0];
+      }
+      for (int q = 0; q < NAVG; q++) avg_sum[q][j-NG][i-NG] += w*sum[q];
+    }
+  }
+
+  avg_tlast = t;
+}
+
+void average_accumulate(struct GridGeom *G, struct FluidState *S)
+{
+  if (nstep % AVG_CADENCE == 0) average_sample(G, S);
+}
+
+//******************************************************************************
+
+// Close the current window: average it over x3 onto the process at the lowest
+// x3 of each column, into out[NAVG][N2][N1], and open the next.
+// Returns 0 for an empty window, else 1 on column roots and -1 elsewhere
+int average_snapshot(struct GridGeom *G, struct FluidState *S, double *out, double *t0)
+{
+  // Initial dump, before the first window opens
+  if (avg_sum == NULL) return 0;
+
+  average_sample(G, S);
+
+  double window = avg_tlast - avg_t0;
+  *t0 = avg_t0;
+  avg_t0 = avg_tlast;
+  if (window <= 0.) return 0;
+
+  int is_root = mpi_reduce_x3(&avg_sum[0][0][0], out, NAVG*N1*N2);
+  for (int n = 0; n < NAVG*N1*N2; n++) out[n] /= window*N3TOT;
+  memset(avg_sum, 0, NAVG*sizeof(*avg_sum));
+
+  return is_root ? 1 : -1;
+}
+
+//******************************************************************************
+
+// Write a closed window as x1,x2 arrays, from the column roots only
+void average_write(const char *fname, double *avg, int is_root, double t0, double t1)
+{
+  double (*in)[N2][N1] = (double (*)[N2][N1]) avg;
+  double *out = calloc(N1*N2, sizeof(double));
+
+  hdf5_create(fname);
+  hdf5_set_directory("/");
+  hdf5_write_single_val(&t0, "t_start", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&t1, "t_end", H5T_IEEE_F64LE);
+  int n1 = N1TOT, n2 = N2TOT;
+  hdf5_write_single_val(&n1, "n1", H5T_STD_I32LE);
+  hdf5_write_single_val(&n2, "n2", H5T_STD_I32LE);
+
+  hsize_t fdims[] = {N1TOT, N2TOT};
+  hsize_t fstart[] = {global_start[0], global_start[1]};
+  hsize_t fcount[] = {is_root ? N1 : 0, is_root ? N2 : 0};
+  hsize_t mstart[] = {0, 0};
+  for (int q = 0; q < NAVG; q++) {
+    for (int i = 0; i < N1; i++)
+      for (int j = 0; j < N2; j++)
+        out[i*N2 + j] = in[q][j][i];
+    hdf5_write_array(out, avg_names[q], 2, fdims, fstart, fcount, fcount, mstart, H5T_IEEE_F64LE);
+    hdf5_add_units(avg_names[q], "code");
+  }
+
+  hdf5_close();
+  free(out);
+}
+
+#endif // AVERAGES
@@ -9,6 +9,10 @@
 //import header files 
 #include "decs.h"
 
+#if COMM_THREAD
+#include <pthread.h>
+#endif
+
 // Sanity checks: grid dimensions, supported boundary conditions
 #if N2 > 1 && N2 < NG
 #error "N2 must be >= NG"
@@ -47,10 +51,15 @@ void inflow_check(struct GridGeom *G, struct FluidState *S, int i, int j,
 //******************************************************************************
 
 // set boundary conditions 
-/////////////////////////////////////
-// TODO make the pflag sync optional
-/////////////////////////////////////
 void set_bounds(struct GridGeom *G, struct FluidState *S)
+{
+  set_bounds_halo(G, S, NVAR, NG, 1);
+}
+
+// set boundary conditions, exchanging only what the next consumer needs:
+// the leading nvar primitives, depth zones deep, and pflag if sync_pflag.
+// Physical boundaries are always filled in full, they cost no communication
+void set_bounds_halo(struct GridGeom *G, struct FluidState *S, int nvar, int depth, int sync_pflag)
 {
   //count time 
   timer_start(TIMER_BOUND);
@@ -149,7 +158,7 @@ void set_bounds(struct GridGeom *G, struct FluidState *S)
 
   // count time
   timer_start(TIMER_BOUND_COMMS);
-  sync_mpi_bound_X1(S);
+  sync_mpi_bound_X1(S, nvar, depth, sync_pflag);
   timer_stop(TIMER_BOUND_COMMS);
 
   //y-direction, inner boundary
@@ -213,7 +222,7 @@ void set_bounds(struct GridGeom *G, struct FluidState *S)
   
   // count time
   timer_start(TIMER_BOUND_COMMS);
-  sync_mpi_bound_X2(S);
+  sync_mpi_bound_X2(S, nvar, depth, sync_pflag);
   timer_stop(TIMER_BOUND_COMMS);
 
   //z-direction, inner boundary
@@ -262,7 +271,7 @@ void set_bounds(struct GridGeom *G, struct FluidState *S)
 
   // count time
   timer_start(TIMER_BOUND_COMMS);
-  sync_mpi_bound_X3(S);
+  sync_mpi_bound_X3(S, nvar, depth, sync_pflag);
   timer_stop(TIMER_BOUND_COMMS);
 
   // total time spent on boundary conditions
@@ -272,6 +281,80 @@ void set_bounds(struct GridGeom *G, struct FluidState *S)
 
 //******************************************************************************
 
+// Non-blocking boundary conditions.  With a communication thread, the whole of
+// set_bounds_halo (physical fills, packing and the MPI exchanges) runs there while
+// the caller gets on with work that touches only the interior of S.
+// set_bounds_finish() must be called before any ghost zone of S is used
+#if COMM_THREAD
+static pthread_mutex_t comm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t comm_cond = PTHREAD_COND_INITIALIZER;
+static struct GridGeom *comm_G;
+static struct FluidState *comm_S;
+static int comm_nvar, comm_depth, comm_sync_pflag;
+static int comm_pending = 0;
+
+static void *comm_thread_loop(void *arg)
+{
+  // Boundary loops are small, don't start a second full OpenMP team from here
+  omp_set_num_threads(1);
+
+  pthread_mutex_lock(&comm_lock);
+  while (1) {
+    while (!comm_pending) pthread_cond_wait(&comm_cond, &comm_lock);
+    pthread_mutex_unlock(&comm_lock);
+
+    set_bounds_halo(comm_G, comm_S, comm_nvar, comm_depth, comm_sync_pflag);
+
+    pthread_mutex_lock(&comm_lock);
+    comm_pending = 0;
+    pthread_cond_broadcast(&comm_cond);
+  }
+  return NULL;
+}
+#endif
+
+void set_bounds_start(struct GridGeom *G, struct FluidState *S, int nvar, int depth, int sync_pflag)
+{
+#if COMM_THREAD
+  if (mpi_thread_multiple()) {
+    static int firstc = 1;
+    if (firstc) {
+      pthread_t comm_thread;
+      if (pthread_create(&comm_thread, NULL, comm_thread_loop, NULL) != 0) {
+        fprintf(stderr, "Could not start communication thread!\n");
+        exit(-1);
+      }
+      pthread_detach(comm_thread);
+      firstc = 0;
+    }
+
+    pthread_mutex_lock(&comm_lock);
+    comm_G = G;
+    comm_S = S;
+    comm_nvar = nvar;
+    comm_depth = depth;
+    comm_sync_pflag = sync_pflag;
+    comm_pending = 1;
+    pthread_cond_broadcast(&comm_cond);
+    pthread_mutex_unlock(&comm_lock);
+    return;
+  }
+#endif
+
+  set_bounds_halo(G, S, nvar, depth, sync_pflag);
+}
+
+void set_bounds_finish()
+{
+#if COMM_THREAD
+  pthread_mutex_lock(&comm_lock);
+  while (comm_pending) pthread_cond_wait(&comm_cond, &comm_lock);
+  pthread_mutex_unlock(&comm_lock);
+#endif
+}
+
+//******************************************************************************
+
 //check if there are inflow at inner/outer boundaries
 #if METRIC == MKS
 void inflow_check(struct GridGeom *G, struct FluidState *S, int i, int j, int k, int type)
@@ -355,11 +355,12 @@ inline void set_grid_loc(struct GridGeom *G, int i, int j, int k, int loc)
 
 //**************************************************************************
 
-//seems to initialize arrays
+//seems to initialize arrays.  No zone's U is up to date with its prims yet
 void zero_arrays()
 {
   ZLOOPALL {
     pflag[k][j][i] = 0;
     fail_save[k][j][i] = 0;
+    uflag[k][j][i] = 1;
   }
 }
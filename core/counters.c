@@ -0,0 +1,189 @@
+//******************************************************************************
+//*                                                                            *
+//* COUNTERS.C                                                                 *
+//*                                                                            *
+//* HARDWARE PERFORMANCE COUNTERS PER TIMER, VIA PERF_EVENT_OPEN               *
+//*                                                                            *
+//******************************************************************************
+
+// import headers
+#include "decs.h"
+
+#if PERF_COUNTERS
+
+#include <ctype.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+// Counted events: cycles, instructions and last-level cache misses, which
+// stand in for DRAM traffic at PERF_LINE_BYTES each, then any raw FP events
+struct CounterEvent {
+  uint64_t config;
+  double flops;
+};
+#ifdef PERF_FLOP_EVENTS
+static struct CounterEvent flop_events[] = {PERF_FLOP_EVENTS};
+#define NFLOP ((int) (sizeof(flop_events)/sizeof(flop_events[0])))
+#else
+static struct CounterEvent *flop_events = NULL;
+#define NFLOP 0
+#endif
+#define EV_CYCLES 0
+#define EV_INSTRUCTIONS 1
+#define EV_LLC_MISSES 2
+#define NEVENT (3 + NFLOP)
+
+// Per thread and event, -1 where the event could not be opened
+static int (*fds)[NEVENT];
+static int nthread_fds = 0;
+
+// Totals per timer, and their values at its start
+static double counts[NUM_TIMERS][NEVENT];
+static double counts_start[NUM_TIMERS][NEVENT];
+
+//******************************************************************************
+
+static int open_event(uint32_t type, uint64_t config)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  // This thread, any CPU
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Open counters on each OpenMP thread.  They are read from the master thread,
+// so the pool must stay the same size after this
+void counter_init()
+{
+  static int firstc = 1;
+  memset(counts, 0, sizeof(counts));
+  if (!firstc) return;
+  firstc = 0;
+
+  nthread_fds = omp_get_max_threads();
+  fds = malloc(nthread_fds*sizeof(*fds));
+  memset(fds, -1, nthread_fds*sizeof(*fds));
+  int nopen[NEVENT] = {0};
+
+#pragma omp parallel
+  {
+    int tid = omp_get_thread_num();
+    if (tid < nthread_fds) {
+      fds[tid][EV_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+      fds[tid][EV_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+      fds[tid][EV_LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+      for (int e = 0; e < NFLOP; e++)
+        fds[tid][3 + e] = open_event(PERF_TYPE_RAW, flop_events[e].config);
+    }
+  }
+
+  for (int tid = 0; tid < nthread_fds; tid++)
+    for (int e = 0; e < NEVENT; e++)
+      if (fds[tid][e] >= 0) nopen[e]++;
+
+  if (nopen[EV_CYCLES] == 0) {
+    fprintf(stderr, "Hardware counters unavailable (%s), check /proc/sys/kernel/perf_event_paranoid\n",
+            strerror(errno));
+    free(fds);
+    fds = NULL;
+    return;
+  }
+  for (int e = 0; e < NEVENT; e++) {
+    if (nopen[e] < nthread_fds)
+      fprintf(stderr, "Counter %d opened on only %d of %d threads\n", e, nopen[e], nthread_fds);
+  }
+}
+
+//******************************************************************************
+
+// Current value of each event, summed over threads
+static void counter_read(double *val)
+{
+  for (int e = 0; e < NEVENT; e++) val[e] = 0.;
+  for (int tid = 0; tid < nthread_fds; tid++) {
+    for (int e = 0; e < NEVENT; e++) {
+      uint64_t c;
+      if (fds[tid][e] >= 0 && read(fds[tid][e], &c, sizeof(c)) == sizeof(c))
+        val[e] += c;
+    }
+  }
+}
+
+// Called by timer_start() and timer_stop(), on the master thread, at the
+// outermost start and stop of each timer
+void counter_start(int timerCode)
+{
+  if (fds == NULL) return;
+  counter_read(counts_start[timerCode]);
+}
+
+void counter_stop(int timerCode)
+{
+  if (fds == NULL) return;
+  double now[NEVENT];
+  counter_read(now);
+  for (int e = 0; e < NEVENT; e++) counts[timerCode][e] += now[e] - counts_start[timerCode][e];
+}
+
+//******************************************************************************
+
+// Roofline-style summary of each timer from its counts and times[], per rank,
+// averaged over ranks.  Clock rates are per thread, the rest summed over them.
+// Bytes are LLC misses times PERF_LINE_BYTES, which ignores writebacks and
+// prefetches, so read the bandwidths as lower bounds.
+// To stdout and dumps/roofline.csv.  Collective
+void counter_report(const double *times, int steps)
+{
+  static double sum[NUM_TIMERS][NEVENT + 1], tot[NUM_TIMERS][NEVENT + 1];
+  for (int n = 0; n < NUM_TIMERS; n++) {
+    for (int e = 0; e < NEVENT; e++) sum[n][e] = counts[n][e];
+    sum[n][NEVENT] = times[n];
+  }
+  mpi_reduce_vector(&sum[0][0], &tot[0][0], NUM_TIMERS*(NEVENT + 1));
+
+  if (!mpi_io_proc() || tot[TIMER_ALL][EV_CYCLES] <= 0.) return;
+
+  double zones = (double) N1TOT*N2TOT*N3TOT*steps;
+  FILE *fp = fopen("dumps/roofline.csv", "w");
+  if (fp != NULL)
+    fprintf(fp, "timer,seconds,cycles,instructions,llc_misses,flops,ghz,ipc,bytes_per_zone,gbytes_per_s,gflops_per_s,flops_per_byte\n");
+
+  fprintf(stdout, "\n********** COUNTERS (PER RANK) **********\n");
+  fprintf(stdout, "   %-12s %7s %7s %11s %9s", "", "GHZ", "IPC", "BYTES/ZONE", "GB/S");
+  if (NFLOP > 0) fprintf(stdout, " %9s %9s", "GFLOP/S", "FLOP/B");
+  fprintf(stdout, "\n");
+  for (int n = 0; n < NUM_TIMERS; n++) {
+    double *c = tot[n], sec = tot[n][NEVENT];
+    if (sec <= 0. || c[EV_CYCLES] <= 0. || timer_name(n) == NULL) continue;
+
+    double flops = 0.;
+    for (int e = 0; e < NFLOP; e++) flops += flop_events[e].flops*c[3 + e];
+    double bytes = PERF_LINE_BYTES*c[EV_LLC_MISSES];
+    double ghz = c[EV_CYCLES]/sec/1.e9/nthread_fds;
+    double ipc = c[EV_INSTRUCTIONS]/c[EV_CYCLES];
+    double gbs = bytes/sec/1.e9;
+    double gflops = flops/sec/1.e9;
+    double intensity = (bytes > 0.) ? flops/bytes : 0.;
+
+    char label[64];
+    snprintf(label, 64, "%s", timer_name(n));
+    for (char *l = label; *l; l++) *l = toupper(*l);
+    fprintf(stdout, "   %-12s %7.3g %7.3g %11.4g %9.4g", label, ghz, ipc, bytes/zones, gbs);
+    if (NFLOP > 0) fprintf(stdout, " %9.4g %9.4g", gflops, intensity);
+    fprintf(stdout, "\n");
+
+    if (fp != NULL)
+      fprintf(fp, "%s,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", timer_name(n),
+              sec/mpi_nprocs(), c[EV_CYCLES], c[EV_INSTRUCTIONS], c[EV_LLC_MISSES], flops,
+              ghz, ipc, bytes/zones, gbs, gflops, intensity);
+  }
+  if (fp != NULL) fclose(fp);
+}
+
+#endif // PERF_COUNTERS
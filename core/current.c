@@ -28,8 +28,8 @@ void current_calc(struct GridGeom *G, struct FluidState *S, struct FluidState *S
   //allocate arrays
   static int first_run = 1;
   if (first_run) {
-    //We only need the primitives, but this is fast
-    Sa = calloc(1,sizeof(struct FluidState));
+    //We only need the primitives and four-vectors, all set below
+    Sa = scratch_state(SCRATCH_CURRENT, STATE_PRIM, "current");
     first_run = 0;
   }
 
@@ -117,8 +117,8 @@ void omega_calc(struct GridGeom *G, struct FluidState *S, GridDouble *omega)
   //allocate
   static int firstc = 1;
   if (firstc) {
-    gFcov01 = calloc (1, sizeof(GridDouble));
-    gFcov13 = calloc (1, sizeof(GridDouble));
+    gFcov01 = calloc_tracked(1, sizeof(GridDouble), "current");
+    gFcov13 = calloc_tracked(1, sizeof(GridDouble), "current");
     firstc = 0;
   }
 
@@ -15,6 +15,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h> //Errors for syscalls
+#include <stdint.h>
+#include <stddef.h>
 
 //include openmp
 #include <omp.h>
@@ -53,6 +55,12 @@
 #define N2       (N2TOT/N2CPU)
 #define N3       (N3TOT/N3CPU)
 
+// Every rank holds an equal block, which is what lets a restart written with
+// one decomposition be read back with another
+#if (N1TOT % N1CPU) || (N2TOT % N2CPU) || (N3TOT % N3CPU)
+#error "NiTOT must be divisible by NiCPU"
+#endif
+
 // Max size for 1D slice is NMAX
 #define N12      (N1 > N2 ? N1 : N2)
 #define NMAX     (N12 > N3 ? N12 : N3)
@@ -131,6 +139,127 @@
 #ifndef STATIC_TIMESTEP
 #define STATIC_TIMESTEP 0
 #endif
+// Run the halo exchange ahead of the corrector on a dedicated communication
+// thread, so it progresses while the workers compute source terms.
+// Needs MPI_THREAD_MULTIPLE, and falls back to blocking exchanges without it
+#ifndef COMM_THREAD
+#define COMM_THREAD 0
+#endif
+// Write dumps and restarts from a background I/O thread, from snapshots of the state.
+// Also needs MPI_THREAD_MULTIPLE, and writes synchronously without it
+#ifndef ASYNC_IO
+#define ASYNC_IO 0
+#endif
+// Write dump and grid fields in memory (x3,x2,x1) order, skipping the transpose.
+// Such datasets carry a "dim_order" attribute, e.g. "var,x3,x2,x1"
+#ifndef DUMP_NATIVE_ORDER
+#define DUMP_NATIVE_ORDER 0
+#endif
+// Prims written in partial dumps, i.e. those between full dumps every DTf,
+// as a mask of variable indices: by default the fluid and field, without the
+// entropies or positrons.  Partial dumps skip jcon, gamma and extras
+#ifndef DUMP_PARTIAL_PRIMS
+#define DUMP_PARTIAL_PRIMS ((1 << RHO) | (1 << UU) | (1 << U1) | (1 << U2) | (1 << U3) | \
+                            (1 << B1) | (1 << B2) | (1 << B3))
+#endif
+// X1 flux profiles, averaged over each log interval, through every
+// FLUX_PROF_STRIDE-th face to dumps/flux_prof.out (0 to skip the file)
+#ifndef FLUX_PROF_STRIDE
+#define FLUX_PROF_STRIDE 1
+#endif
+// Accumulate x3- and time-averaged x1,x2 profiles every AVG_CADENCE steps,
+// written to dumps/avg_XXXXXXXX.h5 with each dump, averaged since the last
+#ifndef AVERAGES
+#define AVERAGES 0
+#endif
+#ifndef AVG_CADENCE
+#define AVG_CADENCE 1
+#endif
+#define NAVG 6
+// Extra outputs of the prims in sub-volumes, each at its own cadence, to
+// dumps/<name>_XXXXXXXX.h5.  A list of {name, cadence, {{i0, i1}, {j0, j1},
+// {k0, k1}}, rmin, rmax, stride}, e.g. in parameters.h
+//   #define OUTPUT_STREAMS {"inner", 0.5, {{0, 0}, {0, 0}, {0, 0}}, 0., 50., 2}
+// Ranges are half-open global zone indices, {0, 0} for a whole direction.
+// rmax > 0 instead keeps the X1 zones centered in [rmin, rmax].  stride > 1
+// coarsens, writing the volume average of each stride^3 block of zones.
+// Blocks reach into neighboring processes' zones by up to stride-1, so
+// stride is at most NG_RECON+1 in directions split across processes
+// Compress dumps: chunk datasets by rank and apply shuffle + deflate at this
+// level (1-9), 0 for contiguous uncompressed datasets
+#ifndef DUMP_DEFLATE
+#define DUMP_DEFLATE 0
+#endif
+// Lossy scale-offset filter on the Lorentz factor in full dumps, keeping this
+// many decimal digits beyond the point, -1 to disable.  The precision is
+// absolute, so values much below 1 would lose all their digits: the prims,
+// jcon and divB are always written losslessly
+#ifndef DUMP_SCALEOFFSET
+#define DUMP_SCALEOFFSET -1
+#endif
+// Prims to keep at double precision in dumps, as a mask of variable indices,
+// e.g. ((1 << RHO) | (1 << UU)).  "prims" stays complete, and these are
+// written again to a double dataset "prims_double", in order of index, named
+// by header/prim_double_names and carrying the mask as its "double_mask"
+// attribute
+#ifndef DUMP_PRIMS_DOUBLE
+#define DUMP_PRIMS_DOUBLE 0
+#endif
+// Compress restarts too, losslessly: shuffle + deflate at this level
+#ifndef RESTART_DEFLATE
+#define RESTART_DEFLATE 0
+#endif
+// Also write a full dump when stopping early for a signal or the walltime
+#ifndef SHUTDOWN_DUMP
+#define SHUTDOWN_DUMP 0
+#endif
+// Accept restarts of other resolutions, moving them onto this grid
+#ifndef RESTART_REGRID
+#define RESTART_REGRID 0
+#endif
+// Count cycles, instructions and LLC misses in each timer with perf_event_open,
+// reported with the timers and to dumps/roofline.csv.  Flops need raw events
+// for the CPU at hand, as {config, flops per count}, e.g. for Intel Skylake
+//   #define PERF_FLOP_EVENTS {0x01c7, 1}, {0x04c7, 2}, {0x10c7, 4}, {0x40c7, 8}
+// Needs TIMERS, and perf_event_paranoid <= 2
+#ifndef PERF_COUNTERS
+#define PERF_COUNTERS 0
+#endif
+#ifndef PERF_LINE_BYTES
+#define PERF_LINE_BYTES 64
+#endif
+// Count solver effort per zone between full dumps, written to their extras:
+// U_to_P iterations over both stages of each step, steps whose corrector
+// failed U_to_P or hit floors or ceilings, and pair production solves,
+// explicit or implicit, with the latter's root-finding steps
+#ifndef ZONE_STATS
+#define ZONE_STATS 0
+#endif
+// Keep the conserved variables from one step to the next, recalculating them
+// from the prims only where fixups changed those (uflag).  Results then differ
+// at the level of the U_to_P tolerance.  0 recalculates everywhere each step,
+// which reproduces older runs bit for bit
+#ifndef KEEP_CONSERVED
+#define KEEP_CONSERVED 0
+#endif
+// Alignment in bytes of the long-lived arrays, see memory.c.  Those of 2MB or
+// more are aligned to 2MB, and with ARENA_HUGEPAGES put on transparent huge pages
+#ifndef ARENA_ALIGN
+#define ARENA_ALIGN 64
+#endif
+#ifndef ARENA_HUGEPAGES
+#define ARENA_HUGEPAGES 1
+#endif
+// Keep only the last RESTART_KEEP regular restart files, 0 to keep them all
+#ifndef RESTART_KEEP
+#define RESTART_KEEP 0
+#endif
+// Rewrite status.json every STATUS_STEPS steps, for monitoring a running job:
+// progress, throughput, the time in each timer, zones with U_to_P failures and
+// floor hits in the corrector since the last update, and peak memory.  0 to skip it
+#ifndef STATUS_STEPS
+#define STATUS_STEPS 10
+#endif
 
 // The Intel compiler is a pain
 // Intel 18.0.0 aka 20170811 works
@@ -155,6 +284,13 @@
 #define PPMX   (4)
 #define WENOZ  (5)
 
+// Ghost zones read by the reconstruction, i.e. the halo needed for the fluxes
+#if RECONSTRUCTION == LINEAR
+#define NG_RECON (2)
+#else
+#define NG_RECON (NG)
+#endif
+
 // Riemann solvers //
 #define LF (0)
 #define HLLE (1)
@@ -258,6 +394,7 @@
 // abort versus regular IO
 #define IO_REGULAR (1)
 #define IO_ABORT (2)
+#define IO_PARTIAL (3)
 
 // Diagnostic calls
 #define DIAG_INIT  (0)
@@ -266,6 +403,11 @@
 #define DIAG_FINAL (3)
 #define DIAG_ABORT (4)
 
+// Reasons to stop before tf
+#define STOP_ABORT (1)
+#define STOP_SIGNAL (2)
+#define STOP_WALLTIME (3)
+
 // Failure modes
 // TODO find+eliminate uses
 #define FAIL_UTOPRIM     (0)
@@ -302,12 +444,13 @@
 #define TIMER_RESTART     (17)
 #define TIMER_CURRENT     (18)
 #define TIMER_ALL         (19)
+#define TIMER_FIXUP_UTOP  (20)
 #if ELECTRONS
 #define TIMER_ELECTRON_FIXUP (21)
 #define TIMER_ELECTRON_HEAT  (22)
 #define NUM_TIMERS           (23)
 #else
-#define NUM_TIMERS     (20)
+#define NUM_TIMERS     (21)
 #endif
 
 /*-----------------------------------*/
@@ -341,15 +484,28 @@ struct GridGeom {
 };
 
 // fluid states, primitive/conservative variables, cov/contravariant vectors
+// Intermediate states are allocated only up to the last field they use, see
+// alloc_state(), so the order matters: P and the four-vectors computed from
+// it, then U, then the current
 struct FluidState {
   GridPrim P;
-  GridPrim U;
   GridVector ucon;
   GridVector ucov;
   GridVector bcon;
   GridVector bcov;
+  GridPrim U;
   GridVector jcon;
 };
+#define STATE_PRIM offsetof(struct FluidState, U)
+#define STATE_CONS offsetof(struct FluidState, jcon)
+#define STATE_FULL sizeof(struct FluidState)
+
+// Phases of a step which never run at once, and so share scratch memory
+#define SCRATCH_ADVANCE 0 // advance_fluid()
+#define SCRATCH_FIXUP   1 // fixup()
+#define SCRATCH_CURRENT 2 // current_calc()
+#define SCRATCH_DIAG    3 // diag(), between steps
+#define NSCRATCH        4
 
 // grid X,T,Z
 struct FluidFlux {
@@ -372,10 +528,23 @@ struct FluidEMF {
 extern GridInt pflag;
 extern GridInt fail_save;
 extern GridInt fflag;
+extern GridInt uflag;
 //////////////////////
 //};
 //////////////////////
 
+// Per-zone effort counters, see ZONE_STATS
+#if ZONE_STATS
+#define ZS_UTOP_ITER     (0)
+#define ZS_UTOP_FAIL     (1)
+#define ZS_FLOOR         (2)
+#define ZS_PAIR_EXPLICIT (3)
+#define ZS_PAIR_IMPLICIT (4)
+#define ZS_PAIR_SOLVE    (5)
+#define NZSTAT           (6)
+extern GridInt zone_stats[NZSTAT];
+#endif
+
 // fluxes and source terms backup
 #if DEBUG
 extern struct FluidFlux preserve_F;
@@ -426,12 +595,11 @@ extern double DTl;
 extern int DTr;
 extern int DTp;
 extern int dump_cnt;
-extern double tdump, tlog;
+extern double tdump, tfull, tlog;
 
 // Diagnostics
-extern double mdot, edot, ldot;
-extern double mdot_eh, edot_eh, ldot_eh;
 extern int icurr, jcurr, kcurr;
+extern long int nfail_utop, nfloor_hit;
 
 // Parallelism
 extern int nthreads;
@@ -550,12 +718,23 @@ extern double Mbh, L_unit, T_unit, RHO_unit, U_unit, B_unit;
 //*
 //*******************************************************************************
 
+// averages.c
+#if AVERAGES
+void average_init();
+void average_accumulate(struct GridGeom *G, struct FluidState *S);
+int average_snapshot(struct GridGeom *G, struct FluidState *S, double *out, double *t0);
+void average_write(const char *fname, double *avg, int is_root, double t0, double t1);
+#endif
+
 // bl_coord.c
 void bl_coord(const double X[NDIM], double *r, double *th);
 
 // bounds.c
 void set_mpi_bounds(struct FluidState *S);
 void set_bounds(struct GridGeom *G, struct FluidState *S);
+void set_bounds_halo(struct GridGeom *G, struct FluidState *S, int nvar, int depth, int sync_pflag);
+void set_bounds_start(struct GridGeom *G, struct FluidState *S, int nvar, int depth, int sync_pflag);
+void set_bounds_finish();
 void fix_flux(struct FluidFlux *F);
 
 // coord.c
@@ -568,13 +747,21 @@ void set_grid(struct GridGeom *G);
 void set_grid_loc(struct GridGeom *G, int i, int j, int k, int loc);
 void zero_arrays();
 
+// counters.c
+#if PERF_COUNTERS
+void counter_init();
+void counter_start(int timerCode);
+void counter_stop(int timerCode);
+void counter_report(const double *times, int steps);
+#endif
+
 // current.c
 void current_calc(struct GridGeom *G, struct FluidState *S, struct FluidState *Ssave, double dtsave);
 void omega_calc(struct GridGeom *G, struct FluidState *S, GridDouble *omega);
 
 // diag.c
 void reset_log_variables();
-void diag_flux(struct FluidFlux *F);
+void diag_flux(struct FluidFlux *F, double Dt);
 void diag(struct GridGeom *G, struct FluidState *S, int call_code);
 double flux_ct_divb(struct GridGeom *G, struct FluidState *S, int i, int j, int k);
 #if DEBUG
@@ -612,6 +799,17 @@ void init_io();
 void dump(struct GridGeom *G, struct FluidState *S);
 void dump_backend(struct GridGeom *G, struct FluidState *S, int type);
 void dump_grid(struct GridGeom *G);
+void dump_wait();
+int io_async();
+void io_submit(void (*write)(void *), void *arg, int *busy);
+void io_wait_for(int *busy);
+
+// memory.c
+void *calloc_tracked(size_t n, size_t size, const char *subsystem);
+struct FluidState *alloc_state(size_t size, const char *subsystem);
+void *scratch_alloc(int phase, size_t nbytes, const char *subsystem);
+struct FluidState *scratch_state(int phase, size_t size, const char *subsystem);
+void report_memory();
 
 // metric.c
 double gcon_func(double gcov[NDIM][NDIM], double gcon[NDIM][NDIM]);
@@ -629,17 +827,24 @@ double invert(double *m, double *inv);
 // mpi.c
 void mpi_initialization(int argc, char *argv[]);
 void mpi_finalize();
-int sync_mpi_bound_X1(struct FluidState *S);
-int sync_mpi_bound_X2(struct FluidState *S);
-int sync_mpi_bound_X3(struct FluidState *S);
+int mpi_thread_multiple();
+int sync_mpi_bound_X1(struct FluidState *S, int nvar, int depth, int sync_pflag);
+int sync_mpi_bound_X2(struct FluidState *S, int nvar, int depth, int sync_pflag);
+int sync_mpi_bound_X3(struct FluidState *S, int nvar, int depth, int sync_pflag);
 void mpi_barrier();
 int mpi_nprocs();
 int mpi_myrank();
 double mpi_max(double f);
 double mpi_min(double f);
+void mpi_min_start(double f);
+double mpi_min_wait();
 double mpi_reduce(double f);
 int mpi_reduce_int(int f);
+uint64_t mpi_reduce_uint64(uint64_t f);
 void mpi_reduce_vector(double *vec_send, double *vec_recv, int len);
+int mpi_reduce_x3(double *vec_send, double *vec_recv, int len);
+void mpi_min_vector(double *vec_send, double *vec_recv, int len);
+void mpi_max_vector(double *vec_send, double *vec_recv, int len);
 int mpi_io_proc();
 void mpi_int_broadcast(int *val);
 void mpi_dbl_broadcast(double *val);
@@ -648,6 +853,8 @@ void mpi_dbl_broadcast(double *val);
 void pack_write_scalar(double in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name, hsize_t hdf5_type);
 void pack_write_int(int in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name);
 void pack_write_vector(double in[][N3+2*NG][N2+2*NG][N1+2*NG], int len, const char* name, hsize_t hdf5_type);
+void pack_write_prims(double in[][N3+2*NG][N2+2*NG][N1+2*NG], int len, const int *vars, const char* name,
+                      hsize_t hdf5_type);
 void pack_write_axiscalar(double in[N2+2*NG][N1+2*NG], const char* name, hsize_t hdf5_type);
 void pack_write_Gtensor(double in[NDIM][NDIM][N2+2*NG][N1+2*NG], const char* name, hsize_t hdf5_type);
 
@@ -689,17 +896,29 @@ void reconstruct(struct FluidState *S, GridPrim Pl, GridPrim Pr, int dir);
 // restart.c
 void restart_write(struct FluidState *S);
 void restart_write_backend(struct FluidState *S, int type);
-void restart_read(char *fname, struct FluidState *S);
+double restart_cost();
+int restart_read(char *fname, struct FluidState *S);
 int restart_init(struct GridGeom *G, struct FluidState *S);
 
 // step.c
 void step(struct GridGeom *G, struct FluidState *S);
 
+// streams.c
+#ifdef OUTPUT_STREAMS
+void stream_init();
+void stream_output(struct GridGeom *G, struct FluidState *S);
+#endif
+
 // timing.c
 void time_init();
 void timer_start(int timerCode);
 void timer_stop(int timerCode);
+void timer_thread_start();
+void timer_thread_stop();
 void report_performance();
+void report_benchmark();
+void report_status();
+const char *timer_name(int timerCode);
 
 // u_to_p.c
 int U_to_P(struct GridGeom *G, struct FluidState *S, int i, int j, int k, int loc);
@@ -14,6 +14,10 @@
 GridInt pflag;
 GridInt fail_save;
 GridInt fflag;
+GridInt uflag;
+#if ZONE_STATS
+GridInt zone_stats[NZSTAT];
+#endif
 
 /*---------------------------------------------------------------*/
 /* arrays */
@@ -64,13 +68,14 @@ double DTl;
 int DTr;
 int DTp;
 int dump_cnt;
-double tdump, tlog;
+double tdump, tfull, tlog;
 
 // derived logged output
-double mdot, edot, ldot;
-double mdot_eh, edot_eh, ldot_eh;
 int icurr, jcurr, kcurr;
 
+// U_to_P failures and floor hits, in zones, since the last status.json
+long int nfail_utop, nfloor_hit;
+
 //electronic variables
 #if ELECTRONS
 double game, gamp;
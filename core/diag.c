@@ -11,34 +11,44 @@
 
 //**************************************************************************
 
-// Evaluate flux based diagnostics; put results in global variables
-// Note this is still per-process
-void diag_flux(struct FluidFlux *F)
+// X1 fluxes through each face of this process (N1 + 1 of them), integrated over
+// time since the last log: rest mass, energy less rest mass, angular momentum
+static double (*flux_sum)[3];
+static double flux_time = 0.;
+
+// Accumulate flux diagnostics over a step of length Dt
+void diag_flux(struct FluidFlux *F, double Dt)
 {
-  // initialize
-  mdot = edot = ldot = 0.;
-  mdot_eh = edot_eh = ldot_eh = 0.;
-  int iEH = NG + 5;
+  static int firstc = 1;
+  if (firstc) {
+    flux_sum = calloc(N1 + 1, sizeof(*flux_sum));
+    firstc = 0;
+  }
 
-  //calculates
-  if (global_start[0] == 0) {
-#if !INTEL_WORKAROUND
-#pragma omp parallel for \
-  reduction(+:mdot) reduction(+:edot) reduction(+:ldot) \
-  reduction(+:mdot_eh) reduction(+:edot_eh) reduction(+:ldot_eh) \
-  collapse(2)
-#endif
-    JSLOOP(0, N2 - 1) {
-      KSLOOP(0, N3 - 1) {
-        mdot += -F->X1[RHO][k][j][NG]*dx[2]*dx[3];
-        edot += (F->X1[UU][k][j][NG] - F->X1[RHO][k][j][NG])*dx[2]*dx[3];
-        ldot += F->X1[U3][k][j][NG]*dx[2]*dx[3];
-        mdot_eh += -F->X1[RHO][k][j][iEH]*dx[2]*dx[3];
-        edot_eh += (F->X1[UU][k][j][iEH] - F->X1[RHO][k][j][iEH])*dx[2]*dx[3];
-        ldot_eh += F->X1[U3][k][j][iEH]*dx[2]*dx[3];
+  // Threads sum whole rows along X1, then combine
+#pragma omp parallel
+  {
+    double sum[N1 + 1][3];
+    memset(sum, 0, sizeof(sum));
+
+#pragma omp for collapse(2)
+    KLOOP {
+      JLOOP {
+        for (int i = NG; i <= N1 + NG; i++) {
+          sum[i-NG][0] += -F->X1[RHO][k][j][i];
+          sum[i-NG][1] += F->X1[UU][k][j][i] - F->X1[RHO][k][j][i];
+          sum[i-NG][2] += F->X1[U3][k][j][i];
+        }
       }
     }
+
+#pragma omp critical
+    for (int i = 0; i <= N1; i++)
+      for (int q = 0; q < 3; q++)
+        flux_sum[i][q] += Dt*dx[2]*dx[3]*sum[i][q];
   }
+
+  flux_time += Dt;
 }
 
 //**************************************************************************
@@ -48,6 +58,9 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
 {
   //Some files i/o related stuff
   static FILE *ener_file;
+#if FLUX_PROF_STRIDE > 0
+  static FILE *prof_file;
+#endif
 
   if (call_code == DIAG_INIT) {
     // Set things up
@@ -57,9 +70,41 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
         fprintf(stderr, "Error opening log file!\n");
         exit(1);
       }
+#if FLUX_PROF_STRIDE > 0
+      prof_file = fopen("dumps/flux_prof.out", "a");
+      if (prof_file == NULL) {
+        fprintf(stderr, "Error opening flux profile file!\n");
+        exit(1);
+      }
+      // Describe the shells once, at the top of a new file
+      if (ftell(prof_file) == 0) {
+        fprintf(prof_file, "# X1 fluxes through shells, averaged over each log interval\n");
+        fprintf(prof_file, "# columns: t, then mdot, edot, ldot at each shell below\n");
+        fprintf(prof_file, "# r:");
+        for (int gi = 0; gi <= N1TOT; gi += FLUX_PROF_STRIDE) {
+          double X[NDIM] = {0., startx[1] + gi*dx[1], startx[2] + 0.5*N2TOT*dx[2], 0.};
+#if METRIC == MKS
+          double r, th;
+          bl_coord(X, &r, &th);
+          fprintf(prof_file, " %.8g", r);
+#else
+          fprintf(prof_file, " %.8g", X[1]);
+#endif
+        }
+        fprintf(prof_file, "\n");
+      }
+#endif
     }
   }
 
+  // Conservative variables of the current prims.  Kept apart from S->U,
+  // which the next step may reuse (KEEP_CONSERVED)
+  static GridPrim *U;
+  static int firstu = 1;
+  if (firstu) {U = scratch_alloc(SCRATCH_DIAG, sizeof(GridPrim), "diag"); firstu = 0;}
+  get_state_vec(G, S, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+  prim_to_flux_vec(G, S, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, *U);
+
   //initialise
   double pp = 0.;
   double divbmax = 0.;
@@ -70,19 +115,15 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
   if (call_code == DIAG_INIT || call_code == DIAG_LOG ||
        call_code == DIAG_FINAL) {
 
-    // conservative variables 
-    get_state_vec(G, S, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
-    prim_to_flux_vec(G, S, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, S->U);
-
 #if !INTEL_WORKAROUND
 #pragma omp parallel for \
   reduction(+:rmed) reduction(+:pp) reduction(+:e) \
   reduction(max:divbmax) collapse(3)
 #endif
     ZLOOP {
-      rmed += S->U[RHO][k][j][i]*dV;
-      pp += S->U[U3][k][j][i]*dV;
-      e += S->U[UU][k][j][i]*dV;
+      rmed += (*U)[RHO][k][j][i]*dV;
+      pp += (*U)[U3][k][j][i]*dV;
+      e += (*U)[UU][k][j][i]*dV;
 
       double divb = flux_ct_divb(G, S, i, j, k);
 
@@ -92,12 +133,6 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
     }
   }
 
-  //mpi stuff
-  rmed = mpi_reduce(rmed);
-  pp = mpi_reduce(pp);
-  e = mpi_reduce(e);
-  divbmax = mpi_max(divbmax);
-
   //initialise
   double mass_proc = 0.;
   double egas_proc = 0.;
@@ -113,8 +148,8 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
 #endif
   ZLOOP {
     //sum mass and internal energy
-    mass_proc += S->U[RHO][k][j][i]*dV;
-    egas_proc += S->U[UU][k][j][i]*dV;
+    mass_proc += (*U)[RHO][k][j][i]*dV;
+    egas_proc += (*U)[UU][k][j][i]*dV;
     double rho = S->P[RHO][k][j][i];
     double Pg = (gam - 1.)*S->P[UU][k][j][i];
     double bsq = bsq_calc(S, i, j, k);
@@ -143,17 +178,48 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
   }
 
   // mpi stuff
-  double mass = mpi_reduce(mass_proc);
-  double egas = mpi_reduce(egas_proc);
-  double Phi = mpi_reduce(Phi_proc);
-  double jet_EM_flux = mpi_reduce(jet_EM_flux_proc);
-  double lum_eht = mpi_reduce(lum_eht_proc);
+  // pack every summed diagnostic into one buffer, so a log costs a single
+  // reduction rather than one global synchronization per scalar.
+  // The flux profiles follow, indexed by global X1 face, each face
+  // summed by the processes which own it
+#define NSUM (8 + 3*(N1TOT + 1))
+  static double *sum_proc, *sum_all;
+  if (sum_proc == NULL) {
+    sum_proc = calloc(NSUM, sizeof(double));
+    sum_all = calloc(NSUM, sizeof(double));
+  }
+  double sum_scalar[8] = {rmed, pp, e, mass_proc, egas_proc, Phi_proc,
+    jet_EM_flux_proc, lum_eht_proc};
+  memcpy(sum_proc, sum_scalar, sizeof(sum_scalar));
+  double (*prof)[3] = (double (*)[3]) (sum_all + 8);
+  // No time accumulated, e.g. a final call right after a log, reports zero
+  memset(sum_proc + 8, 0, 3*(N1TOT + 1)*sizeof(double));
+  if (flux_time > 0.) {
+    int nface = (global_stop[0] == N1TOT) ? N1 + 1 : N1;
+    for (int i = 0; i < nface; i++)
+      for (int q = 0; q < 3; q++)
+        sum_proc[8 + 3*(global_start[0] + i) + q] = flux_sum[i][q]/flux_time;
+  }
+  mpi_reduce_vector(sum_proc, sum_all, NSUM);
+  divbmax = mpi_max(divbmax);
+
+  rmed = sum_all[0];
+  pp = sum_all[1];
+  e = sum_all[2];
+  double mass = sum_all[3];
+  double egas = sum_all[4];
+  double Phi = sum_all[5];
+  double jet_EM_flux = sum_all[6];
+  double lum_eht = sum_all[7];
 
   //files i/o
   if ((call_code == DIAG_INIT && !is_restart) ||
-    call_code == DIAG_DUMP || call_code == DIAG_FINAL) {
+    call_code == DIAG_FINAL) {
     dump(G, S);
     dump_cnt++;
+  } else if (call_code == DIAG_DUMP) {
+    dump_backend(G, S, (t >= tfull) ? IO_REGULAR : IO_PARTIAL);
+    dump_cnt++;
   }
 
   //files i/o
@@ -164,12 +230,14 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
   // mpi stuff
   if (call_code == DIAG_INIT || call_code == DIAG_LOG ||
       call_code == DIAG_FINAL) {
-    double mdot_all = mpi_reduce(mdot);
-    double edot_all = mpi_reduce(edot);
-    double ldot_all = mpi_reduce(ldot);
-    double mdot_eh_all = mpi_reduce(mdot_eh);
-    double edot_eh_all = mpi_reduce(edot_eh);
-    double ldot_eh_all = mpi_reduce(ldot_eh);
+    // Fluxes at the inner edge and near the horizon, since the last log
+    int iEH = MY_MIN(5, N1TOT);
+    double mdot_all = prof[0][0];
+    double edot_all = prof[0][1];
+    double ldot_all = prof[0][2];
+    double mdot_eh_all = prof[iEH][0];
+    double edot_eh_all = prof[iEH][1];
+    double ldot_eh_all = prof[iEH][2];
 
     //mdot will be negative w/scheme above
     double phi = Phi/sqrt(fabs(mdot_all) + SMALL);
@@ -190,6 +258,23 @@ void diag(struct GridGeom *G, struct FluidState *S, int call_code)
       fprintf(ener_file, "%15.8g %15.8g %15.8g ", mdot_eh_all, edot_eh_all, ldot_eh_all);
       fprintf(ener_file, "\n");
       fflush(ener_file);
+
+#if FLUX_PROF_STRIDE > 0
+      if (flux_time > 0.) {
+        fprintf(prof_file, "%.8g", t);
+        for (int q = 0; q < 3; q++)
+          for (int gi = 0; gi <= N1TOT; gi += FLUX_PROF_STRIDE)
+            fprintf(prof_file, " %.8g", prof[gi][q]);
+        fprintf(prof_file, "\n");
+        fflush(prof_file);
+      }
+#endif
+    }
+
+    // Start the next interval
+    if (flux_time > 0.) {
+      memset(flux_sum, 0, (N1 + 1)*sizeof(*flux_sum));
+      flux_time = 0.;
     }
   }
 }
@@ -46,7 +46,7 @@ void fixup(struct GridGeom *G, struct FluidState *S)
 
   //allocate arrays
   static int firstc = 1;
-  if (firstc) {Stmp = calloc(1,sizeof(struct FluidState)); firstc = 0;}
+  if (firstc) {Stmp = scratch_state(SCRATCH_FIXUP, STATE_CONS, "fixup"); firstc = 0;}
 
   // initialize flag
 #pragma omp parallel for simd collapse(3)
@@ -60,8 +60,19 @@ void fixup(struct GridGeom *G, struct FluidState *S)
   get_state_vec(G, S, CENT, 0, N3-1, 0, N2-1, 0, N1-1);
 
   // appply floors
-#pragma omp parallel for collapse(3)
-  ZLOOP fixup_floor(G, S, i, j, k);
+  long int nfloor = 0;
+#pragma omp parallel
+  {
+    timer_thread_start();
+#pragma omp for collapse(3) nowait reduction(+:nfloor)
+    ZLOOP {
+      fixup_floor(G, S, i, j, k);
+      nfloor += (fflag[k][j][i] != 0);
+      if (fflag[k][j][i]) uflag[k][j][i] = 1;
+    }
+    timer_thread_stop();
+  }
+  nfloor_hit += nfloor;
 
   // Some debug info about floors
 #if DEBUG
@@ -338,7 +349,7 @@ inline void fixup_floor(struct GridGeom *G, struct FluidState *S, int i, int j,
 void fixup_utoprim(struct GridGeom *G, struct FluidState *S)
 {
   // count time
-  timer_start(TIMER_FIXUP);
+  timer_start(TIMER_FIXUP_UTOP);
 
   // Flip the logic of the pflag[] so that it now indicates which cells are good
 #pragma omp parallel for simd collapse(3)
@@ -347,13 +358,14 @@ void fixup_utoprim(struct GridGeom *G, struct FluidState *S)
   }
 
   // count number of bad cells
-#if DEBUG
+#if DEBUG || STATUS_STEPS
   int nbad_utop = 0;
 #pragma omp parallel for simd collapse(3) reduction (+:nbad_utop)
   ZLOOP {
     // Count the 0 = bad cells
     nbad_utop += !pflag[k][j][i];
   }
+  nfail_utop += nbad_utop;
   LOGN("Fixing %d bad cells", nbad_utop);
 #endif
 
@@ -448,6 +460,6 @@ void fixup_utoprim(struct GridGeom *G, struct FluidState *S)
   }
 
   // count time
-  timer_stop(TIMER_FIXUP);
+  timer_stop(TIMER_FIXUP_UTOP);
 }
 #undef FLOOP
@@ -74,9 +74,9 @@ double get_flux(struct GridGeom *G, struct FluidState *S, struct FluidFlux *F)
   //allocate variables
   static int firstc = 1;
   if (firstc) {
-    Sl  = calloc(1,sizeof(struct FluidState));
-    Sr  = calloc(1,sizeof(struct FluidState));
-    ctop = calloc(1,sizeof(GridVector));
+    Sl  = alloc_state(STATE_CONS, "fluxes");
+    Sr  = alloc_state(STATE_CONS, "fluxes");
+    ctop = calloc_tracked(1,sizeof(GridVector), "fluxes");
 
     firstc = 0;
   }
@@ -127,14 +127,14 @@ void lr_to_flux(struct GridGeom *G, struct FluidState *Sr,
   // allocate arrays
   static int firstc = 1;
   if (firstc) {
-    fluxL = calloc(1,sizeof(GridPrim));
-    fluxR = calloc(1,sizeof(GridPrim));
-    cmaxL = calloc(1,sizeof(GridDouble));
-    cmaxR = calloc(1,sizeof(GridDouble));
-    cminL = calloc(1,sizeof(GridDouble));
-    cminR = calloc(1,sizeof(GridDouble));
-    cmax = calloc(1,sizeof(GridDouble));
-    cmin = calloc(1,sizeof(GridDouble));
+    fluxL = calloc_tracked(1,sizeof(GridPrim), "fluxes");
+    fluxR = calloc_tracked(1,sizeof(GridPrim), "fluxes");
+    cmaxL = calloc_tracked(1,sizeof(GridDouble), "fluxes");
+    cmaxR = calloc_tracked(1,sizeof(GridDouble), "fluxes");
+    cminL = calloc_tracked(1,sizeof(GridDouble), "fluxes");
+    cminR = calloc_tracked(1,sizeof(GridDouble), "fluxes");
+    cmax = calloc_tracked(1,sizeof(GridDouble), "fluxes");
+    cmin = calloc_tracked(1,sizeof(GridDouble), "fluxes");
 
     firstc = 0;
   }
@@ -299,7 +299,7 @@ void flux_ct(struct FluidFlux *F)
   //allocate arrays
   static int firstc = 1;
   if (firstc) {
-    emf = calloc(1,sizeof(struct FluidEMF));
+    emf = calloc_tracked(1,sizeof(struct FluidEMF), "fluxes");
     firstc = 0;
   }
 
@@ -49,6 +49,10 @@ static char hdf5_cur_dir[STRLEN] = "/";
 // Keep the file pointer globally.  This means ONE FILE AT A TIME!
 hid_t file_id;
 
+// Filters for new arrays in the current file, reset on create
+static int deflate_level = 0;
+static int scaleoffset_digits = -1;
+
 //******************************************************************************
 
 // Create a new HDF5 file in memory and group specified by name to
@@ -123,6 +127,9 @@ int hdf5_create(const char *fname)
   file_id = H5Fcreate(fname, H5F_ACC_TRUNC, H5P_DEFAULT, plist_id);
   H5Pclose(plist_id);
 
+  // New files start uncompressed
+  hdf5_set_filters(0, -1);
+
   // Everyone expects directory to be root after opening a file
   hdf5_set_directory("/");
 
@@ -157,6 +164,19 @@ int hdf5_open(const char *fname)
 
 //******************************************************************************
 
+// Whether a file opens cleanly, without failing hard if not.
+// Serial, so callers need not all take part
+int hdf5_can_open(const char *fname)
+{
+  H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+  hid_t fid = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (fid < 0) return 0;
+  H5Fclose(fid);
+  return 1;
+}
+
+//******************************************************************************
+
 // Close a file
 int hdf5_close()
 {
@@ -169,6 +189,26 @@ int hdf5_close()
 
 //******************************************************************************
 
+// Compress arrays written from now on to the current file.  Arrays are chunked
+// by each process's block, then shuffled and deflated at 'level' (1-9, 0 off).
+// With 'digits' >= 0, float arrays first pass the lossy scale-offset filter,
+// keeping that many decimal digits
+void hdf5_set_filters(int level, int digits)
+{
+  static int warned = 0;
+  if ((level > 0 && !H5Zfilter_avail(H5Z_FILTER_DEFLATE)) ||
+      (digits >= 0 && !H5Zfilter_avail(H5Z_FILTER_SCALEOFFSET))) {
+    if (!warned) fprintf(stderr, "HDF5 library lacks requested filters, writing uncompressed\n");
+    warned = 1;
+    level = 0;
+    digits = -1;
+  }
+  deflate_level = level;
+  scaleoffset_digits = digits;
+}
+
+//******************************************************************************
+
 // Make a directory (in the current directory) with given name
 // This doesn't take a full path, just a name
 int hdf5_make_directory(const char *name)
@@ -290,16 +330,28 @@ int hdf5_write_str_list(const void *data, const char *name, size_t str_len, size
 
 // Write the section 'mdims_copy' starting at 'mstart' of a C-order array of rank 'rank' and size 'mdims_full'
 // To the section 'fdims' at 'fstart' of the file 'file_id'
+// A zero in 'fcount' means this process writes nothing, but still joins the collective write.
+// Arrays written this way can't be chunked, so don't set filters for them
 int hdf5_write_array(const void *data, const char *name, size_t rank,
                       hsize_t *fdims, hsize_t *fstart, hsize_t *fcount, hsize_t *mdims, hsize_t *mstart, hsize_t hdf5_type)
 {
+  int empty = 0;
+  for (size_t d = 0; d < rank; d++) if (fcount[d] == 0) empty = 1;
+
   // Declare spaces of the right size
   hid_t filespace = H5Screate_simple(rank, fdims, NULL);
-  H5Sselect_hyperslab(filespace, H5S_SELECT_SET, fstart, NULL, fcount,
-    NULL);
-  hid_t memspace = H5Screate_simple(rank, mdims, NULL);
-  H5Sselect_hyperslab(memspace, H5S_SELECT_SET, mstart, NULL, fcount,
-    NULL);
+  hid_t memspace;
+  if (empty) {
+    H5Sselect_none(filespace);
+    memspace = H5Screate_simple(rank, fdims, NULL);
+    H5Sselect_none(memspace);
+  } else {
+    H5Sselect_hyperslab(filespace, H5S_SELECT_SET, fstart, NULL, fcount,
+      NULL);
+    memspace = H5Screate_simple(rank, mdims, NULL);
+    H5Sselect_hyperslab(memspace, H5S_SELECT_SET, mstart, NULL, fcount,
+      NULL);
+  }
 
   // Add our current path to the dataset name
   char path[STRLEN];
@@ -310,6 +362,15 @@ int hdf5_write_array(const void *data, const char *name, size_t rank,
 
   // Create the dataset in the file
   hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+  int lossy = scaleoffset_digits >= 0 && H5Tget_class(hdf5_type) == H5T_FLOAT && H5Tget_size(hdf5_type) == 4;
+  if (deflate_level > 0 || lossy) {
+    H5Pset_chunk(plist_id, rank, fcount);
+    if (lossy) H5Pset_scaleoffset(plist_id, H5Z_SO_FLOAT_DSCALE, scaleoffset_digits);
+    if (deflate_level > 0) {
+      H5Pset_shuffle(plist_id);
+      H5Pset_deflate(plist_id, deflate_level);
+    }
+  }
   hid_t dset_id = H5Dcreate(file_id, path, hdf5_type, filespace, H5P_DEFAULT,
     plist_id, H5P_DEFAULT);
   H5Pclose(plist_id);
@@ -398,10 +459,10 @@ int hdf5_read_single_val(void *val, const char *name, hsize_t hdf5_type)
 int hdf5_read_array(void *data, const char *name, size_t rank,
                       hsize_t *fdims, hsize_t *fstart, hsize_t *fcount, hsize_t *mdims, hsize_t *mstart, hsize_t hdf5_type)
 {
-  hid_t filespace = H5Screate_simple(4, fdims, NULL);
+  hid_t filespace = H5Screate_simple(rank, fdims, NULL);
   H5Sselect_hyperslab(filespace, H5S_SELECT_SET, fstart, NULL, fcount,
     NULL);
-  hid_t memspace = H5Screate_simple(4, mdims, NULL);
+  hid_t memspace = H5Screate_simple(rank, mdims, NULL);
   H5Sselect_hyperslab(memspace, H5S_SELECT_SET, mstart, NULL, fcount,
     NULL);
 
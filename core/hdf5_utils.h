@@ -24,8 +24,12 @@ int hdf5_close_blob(hdf5_blob blob);
 // File
 int hdf5_create(const char *fname);
 int hdf5_open(const char *fname);
+int hdf5_can_open(const char *fname);
 int hdf5_close();
 
+// Compression of new arrays
+void hdf5_set_filters(int level, int digits);
+
 // Directory
 int hdf5_make_directory(const char *name);
 void hdf5_set_directory(const char *path);
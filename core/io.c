@@ -16,6 +16,16 @@
 #include <sys/stat.h>
 #include <ctype.h>
 
+// Debug dumps write U and fluxes straight out of the solver, so stay synchronous
+#if DEBUG
+#undef ASYNC_IO
+#define ASYNC_IO 0
+#endif
+
+#if ASYNC_IO
+#include <pthread.h>
+#endif
+
 /////////////////////////////////////
 // TODO move bsq to this scope? (no)
 /////////////////////////////////////
@@ -32,6 +42,27 @@
 // delcare
 #define HDF_STR_LEN 20
 
+// Everything a dump file needs from the fluid state, taken at the time of the dump
+struct DumpStage {
+  GridPrim *P;
+  GridVector *jcon;
+  GridDouble *gamma, *divb;
+  GridInt *fail, *fixup;
+#if ZONE_STATS
+  GridInt *stats;
+#endif
+#if DEBUG
+  GridPrim *U;
+#endif
+  double t, dt;
+  int nstep, dump_cnt, is_full_dump, busy;
+#if AVERAGES
+  double *avg, avg_t0;
+  int avg_status;
+#endif
+  char fname[80];
+};
+
 //***************************************************************************************
 
 //output dump
@@ -42,15 +73,10 @@ void dump(struct GridGeom *G, struct FluidState *S)
 
 //***************************************************************************************
 
-//write dump
-void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
+//write a staged dump to its file
+static void dump_write(void *arg)
 {
-  //count time
-  timer_start(TIMER_IO);
-
-  //declare
-  static GridDouble *data;
-  char fname[80];
+  struct DumpStage *d = (struct DumpStage *) arg;
 
   // *********************************************************************************** //
   // output file names //
@@ -103,29 +129,32 @@ void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
   #endif
   
   // *********************************************************************************** //
-  
-  //allocate arrays
-  static int firstc = 1;
-  if(firstc) {
-    data = calloc(1,sizeof(GridDouble));
-    firstc = 0;
-  }
 
-  //Don't re-dump the grid after a restart
-  if (dump_cnt == 0) dump_grid(G);
+  // Partial dumps carry only the prims in DUMP_PARTIAL_PRIMS
+  int vars[NVAR], n_prims = 0;
+  char prim_names[NVAR][HDF_STR_LEN];
+  PLOOP {
+    if (d->is_full_dump || (DUMP_PARTIAL_PRIMS & (1 << ip))) {
+      strcpy(prim_names[n_prims], varNames[ip]);
+      vars[n_prims++] = ip;
+    }
+  }
 
-  //dump file type
-  if (type == IO_REGULAR) {
-    sprintf(fname, "dumps/dump_%08d.h5", dump_cnt);
-  } else if (type == IO_ABORT) {
-    sprintf(fname, "dumps/dump_abort.h5");    
+  // Of those, the ones also written at full precision to "prims_double"
+  int vars_double[NVAR], n_double = 0;
+  char double_names[NVAR][HDF_STR_LEN];
+#if DUMP_PRIMS_DOUBLE && !DEBUG
+  for (int n = 0; n < n_prims; n++) {
+    if (DUMP_PRIMS_DOUBLE & (1 << vars[n])) {
+      strcpy(double_names[n_double], prim_names[n]);
+      vars_double[n_double++] = vars[n];
+    }
   }
+#endif
 
-  //mpi stuff
-  if(mpi_io_proc()) fprintf(stdout, "DUMP %s\n", fname);
-  
   //open hdf5 file
-  hdf5_create(fname);
+  hdf5_create(d->fname);
+  hdf5_set_filters(DUMP_DEFLATE, -1);
 
   //Can use H5T_VARIABLE for any-length strings. But not compatible with parallel IO
   hid_t string_type = hdf5_make_str_type(HDF_STR_LEN);
@@ -182,13 +211,16 @@ void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
   hdf5_write_single_val(&n3, "n3", H5T_STD_I32LE);
 
   // write number of primitive variables
-  int n_prims = NVAR;
   hdf5_write_single_val(&n_prims, "n_prim", H5T_STD_I32LE);
 
   // In case we do passive variables
   int n_prims_passive = 0;
   hdf5_write_single_val(&n_prims_passive, "n_prims_passive", H5T_STD_I32LE);
-  hdf5_write_str_list(varNames, "prim_names", HDF_STR_LEN, n_prims);
+  hdf5_write_str_list(prim_names, "prim_names", HDF_STR_LEN, n_prims);
+  if (n_double > 0) {
+    hdf5_write_single_val(&n_double, "n_prim_double", H5T_STD_I32LE);
+    hdf5_write_str_list(double_names, "prim_double_names", HDF_STR_LEN, n_double);
+  }
 
   //gas constant
   hdf5_write_single_val(&gam, "gam", H5T_IEEE_F64LE);
@@ -255,33 +287,39 @@ void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
   // hdf5 file directory
   hdf5_set_directory("/");
 
-  //////////////////////////////////
-  // TODO do partial/full dumps
-  //////////////////////////////////
-
-  // what are these?
-  int is_full_dump = 1; 
-  hdf5_write_single_val(&is_full_dump, "is_full_dump", H5T_STD_I32LE);
-  hdf5_write_single_val(&t, "t", H5T_IEEE_F64LE);
+  // Full dumps every DTf, partial ones in between
+  hdf5_write_single_val(&d->is_full_dump, "is_full_dump", H5T_STD_I32LE);
+  hdf5_write_single_val(&d->t, "t", H5T_IEEE_F64LE);
   hdf5_add_units("t", "code");
-  hdf5_write_single_val(&dt, "dt", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&d->dt, "dt", H5T_IEEE_F64LE);
   hdf5_add_units("dt", "code");
-  hdf5_write_single_val(&nstep, "n_step", H5T_STD_I32LE);
-  hdf5_write_single_val(&dump_cnt, "n_dump", H5T_STD_I32LE);
+  hdf5_write_single_val(&d->nstep, "n_step", H5T_STD_I32LE);
+  hdf5_write_single_val(&d->dump_cnt, "n_dump", H5T_STD_I32LE);
   hdf5_write_single_val(&DTd, "dump_cadence", H5T_IEEE_F64LE);
   hdf5_write_single_val(&DTf, "full_dump_cadence", H5T_IEEE_F64LE);
 
-  // Write primitive variables
-  pack_write_vector(S->P, NVAR, "prims", OUT_H5_TYPE);
+  // Write primitive variables, never through the lossy filter
+  pack_write_prims(*d->P, n_prims, vars, "prims", OUT_H5_TYPE);
   hdf5_add_units("prims", "code");
+  // Those in DUMP_PRIMS_DOUBLE again at full precision, named in the header
+  if (n_double > 0) {
+    int prims_double = DUMP_PRIMS_DOUBLE;
+    pack_write_prims(*d->P, n_double, vars_double, "prims_double", H5T_IEEE_F64LE);
+    hdf5_add_attr(&prims_double, "double_mask", "prims_double", H5T_STD_I32LE);
+    hdf5_add_units("prims_double", "code");
+  }
 
-  // Write jcon (not recoverable from prims)
-  pack_write_vector(S->jcon, NDIM, "jcon", OUT_H5_TYPE);
-  hdf5_add_units("jcon", "code");
+  if (d->is_full_dump) {
+    // Write jcon (not recoverable from prims)
+    pack_write_vector(*d->jcon, NDIM, "jcon", OUT_H5_TYPE);
+    hdf5_add_units("jcon", "code");
 
-  // lorentz factors
-  ZLOOP (*data)[k][j][i] = mhd_gamma_calc(G, S, i, j, k, CENT);
-  pack_write_scalar((*data), "gamma", OUT_H5_TYPE);
+    // lorentz factors, >= 1 and bounded by GAMMAMAX, so the one field taken
+    // through the lossy filter.  Small ones like jcon and divB would be zeroed
+    hdf5_set_filters(DUMP_DEFLATE, DUMP_SCALEOFFSET);
+    pack_write_scalar(*d->gamma, "gamma", OUT_H5_TYPE);
+    hdf5_set_filters(DUMP_DEFLATE, -1);
+  }
 
   // Space for any extra items
   // Currently debug/diagnostic output, on full dumps only
@@ -294,26 +332,27 @@ void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
 #endif
 
   // write error stuff
-  if (is_full_dump) {
-    ///////////////////////////////////////////////
-    // TODO need sync here for consistent output?
-    ///////////////////////////////////////////////
-    ZLOOP (*data)[k][j][i] = flux_ct_divb(G, S, i, j, k);
-    pack_write_scalar((*data), "divB", OUT_H5_TYPE);
-
-    pack_write_int(fail_save, "fail");
-    ZLOOP fail_save[k][j][i] = 0;
-
-    pack_write_int(fflag, "fixup");
+  if (d->is_full_dump) {
+    pack_write_scalar(*d->divb, "divB", OUT_H5_TYPE);
+    pack_write_int(*d->fail, "fail");
+    pack_write_int(*d->fixup, "fixup");
+#if ZONE_STATS
+    // Counts since the last full dump
+    const char *stat_names[NZSTAT] = {"utop_iter", "utop_fail", "floor_hits",
+                                      "pair_explicit", "pair_implicit", "pair_solve_steps"};
+    for (int n = 0; n < NZSTAT; n++) pack_write_int(d->stats[n], stat_names[n]);
+#endif
   }
 
   // write conservative varaiables, fluxes, and source terms
 #if DEBUG
-    pack_write_vector(S->U, NVAR, "U", OUT_H5_TYPE);
+  if (d->is_full_dump) {
+    pack_write_vector(*d->U, NVAR, "U", OUT_H5_TYPE);
     pack_write_vector(preserve_F.X1, NVAR, "X1", OUT_H5_TYPE);
     pack_write_vector(preserve_F.X2, NVAR, "X2", OUT_H5_TYPE);
     pack_write_vector(preserve_F.X3, NVAR, "X3", OUT_H5_TYPE);
     pack_write_vector(preserve_dU, NVAR, "dU", OUT_H5_TYPE);
+  }
 #endif
 
   ///////////////////////////////////////////////////////////////////
@@ -331,6 +370,219 @@ void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
   //close files
   hdf5_close();
 
+#if AVERAGES
+  if (d->avg_status != 0) {
+    char avg_fname[80];
+    sprintf(avg_fname, "dumps/avg_%08d.h5", d->dump_cnt);
+    average_write(avg_fname, d->avg, d->avg_status > 0, d->avg_t0, d->t);
+  }
+#endif
+}
+
+//***************************************************************************************
+
+// Asynchronous output: the time loop only snapshots the state into a staging
+// buffer, and a dedicated I/O thread writes the files in the order queued.
+// Each buffer is marked busy until written, so a new dump or restart waits only
+// if its buffer is still queued.  Output streams add a stage each, so a full
+// queue makes io_submit wait for the oldest job.
+// HDF5 writes through MPI_COMM_WORLD, while the solver communicates on the
+// Cartesian communicator, so the two threads never share a collective
+#if ASYNC_IO
+#define IO_QUEUE 4
+struct IOJob {
+  void (*write)(void *);
+  void *arg;
+  int *busy;
+};
+static struct IOJob io_jobs[IO_QUEUE];
+static int io_head = 0, io_tail = 0;
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
+
+static void *io_thread_loop(void *arg)
+{
+  // Leave the cores to the solver
+  omp_set_num_threads(1);
+
+  pthread_mutex_lock(&io_lock);
+  while (1) {
+    while (io_head == io_tail) pthread_cond_wait(&io_cond, &io_lock);
+    struct IOJob job = io_jobs[io_head];
+    pthread_mutex_unlock(&io_lock);
+
+    job.write(job.arg);
+
+    pthread_mutex_lock(&io_lock);
+    *job.busy = 0;
+    io_head = (io_head + 1) % IO_QUEUE;
+    pthread_cond_broadcast(&io_cond);
+  }
+  return NULL;
+}
+#endif
+
+// Whether writes go to the I/O thread, which is started on first call.
+// Without a thread-safe MPI, everything is written from the calling thread
+int io_async()
+{
+  static int async = -1;
+  if (async < 0) {
+    async = 0;
+#if ASYNC_IO
+    async = mpi_thread_multiple();
+    if (!async && mpi_io_proc())
+      fprintf(stderr, "MPI library does not provide MPI_THREAD_MULTIPLE, writing output synchronously\n");
+    if (async) {
+      pthread_t io_thread;
+      if (pthread_create(&io_thread, NULL, io_thread_loop, NULL) != 0) {
+        fprintf(stderr, "Could not start I/O thread!\n");
+        exit(-1);
+      }
+      pthread_detach(io_thread);
+    }
+#endif
+  }
+  return async;
+}
+
+// Queue write(arg) for the I/O thread, marking *busy until it is done,
+// or just call it if writing synchronously
+void io_submit(void (*write)(void *), void *arg, int *busy)
+{
+#if ASYNC_IO
+  if (io_async()) {
+    pthread_mutex_lock(&io_lock);
+    while ((io_tail + 1) % IO_QUEUE == io_head) pthread_cond_wait(&io_cond, &io_lock);
+    *busy = 1;
+    io_jobs[io_tail] = (struct IOJob) {write, arg, busy};
+    io_tail = (io_tail + 1) % IO_QUEUE;
+    pthread_cond_broadcast(&io_cond);
+    pthread_mutex_unlock(&io_lock);
+    return;
+  }
+#endif
+  write(arg);
+}
+
+// Block until a staging buffer is free to refill
+void io_wait_for(int *busy)
+{
+#if ASYNC_IO
+  pthread_mutex_lock(&io_lock);
+  while (*busy) pthread_cond_wait(&io_cond, &io_lock);
+  pthread_mutex_unlock(&io_lock);
+#endif
+}
+
+// Block until all queued output is on disk.  Must precede any other HDF5 use
+void dump_wait()
+{
+#if ASYNC_IO
+  pthread_mutex_lock(&io_lock);
+  while (io_head != io_tail) pthread_cond_wait(&io_cond, &io_lock);
+  pthread_mutex_unlock(&io_lock);
+#endif
+}
+
+//***************************************************************************************
+
+//write dump
+void dump_backend(struct GridGeom *G, struct FluidState *S, int type)
+{
+  //count time
+  timer_start(TIMER_IO);
+
+  // Without a thread-safe MPI, write from this thread as before.  Then P and
+  // jcon are written straight from S, and only the derived fields are staged
+  static struct DumpStage stage[2];
+  static int async = 0, fill = 0;
+  static int firstc = 1;
+  if (firstc) {
+    async = io_async();
+    for (int n = 0; n < 1 + async; n++) {
+      if (async) {
+        stage[n].P = calloc_tracked(1,sizeof(GridPrim), "io");
+        stage[n].jcon = calloc_tracked(1,sizeof(GridVector), "io");
+      }
+      stage[n].gamma = calloc_tracked(1,sizeof(GridDouble), "io");
+      stage[n].divb = calloc_tracked(1,sizeof(GridDouble), "io");
+      stage[n].fail = calloc_tracked(1,sizeof(GridInt), "io");
+      stage[n].fixup = calloc_tracked(1,sizeof(GridInt), "io");
+#if ZONE_STATS
+      stage[n].stats = calloc_tracked(NZSTAT,sizeof(GridInt), "io");
+#endif
+#if AVERAGES
+      stage[n].avg = calloc_tracked(NAVG*N1*N2, sizeof(double), "io");
+#endif
+    }
+    firstc = 0;
+  }
+
+  //Don't re-dump the grid after a restart
+  if (dump_cnt == 0) {
+    dump_wait();
+    dump_grid(G);
+  }
+
+  // Back-pressure: wait for the buffer we are about to fill
+  struct DumpStage *d = &stage[fill];
+  io_wait_for(&d->busy);
+
+  //dump file type
+  d->is_full_dump = (type != IO_PARTIAL);
+  if (type == IO_REGULAR || type == IO_PARTIAL) {
+    sprintf(d->fname, "dumps/dump_%08d.h5", dump_cnt);
+  } else if (type == IO_ABORT) {
+    sprintf(d->fname, "dumps/dump_abort.h5");
+  }
+
+  //mpi stuff
+  if(mpi_io_proc()) fprintf(stdout, "DUMP %s\n", d->fname);
+
+  // Snapshot
+  d->t = t;
+  d->dt = dt;
+  d->nstep = nstep;
+  d->dump_cnt = dump_cnt;
+  if (async) {
+    memcpy(d->P, S->P, sizeof(GridPrim));
+    if (d->is_full_dump) memcpy(d->jcon, S->jcon, sizeof(GridVector));
+  } else {
+    d->P = &S->P;
+    d->jcon = &S->jcon;
+  }
+#if DEBUG
+  d->U = &S->U;
+#endif
+#if AVERAGES
+  d->avg_status = (type == IO_ABORT) ? 0 : average_snapshot(G, S, d->avg, &d->avg_t0);
+#endif
+
+  ///////////////////////////////////////////////
+  // TODO need sync here for consistent output?
+  ///////////////////////////////////////////////
+  // Failures accumulate until the next full dump
+  if (d->is_full_dump) {
+#pragma omp parallel for collapse(3)
+    ZLOOP {
+      (*d->gamma)[k][j][i] = mhd_gamma_calc(G, S, i, j, k, CENT);
+      (*d->divb)[k][j][i] = flux_ct_divb(G, S, i, j, k);
+      (*d->fail)[k][j][i] = fail_save[k][j][i];
+      (*d->fixup)[k][j][i] = fflag[k][j][i];
+      fail_save[k][j][i] = 0;
+#if ZONE_STATS
+      for (int n = 0; n < NZSTAT; n++) {
+        d->stats[n][k][j][i] = zone_stats[n][k][j][i];
+        zone_stats[n][k][j][i] = 0;
+      }
+#endif
+    }
+  }
+
+  io_submit(dump_write, d, &d->busy);
+  if (async) fill = !fill;
+
   //count time
   timer_stop(TIMER_IO);
 }
@@ -354,8 +606,9 @@ void dump_grid(struct GridGeom *G)
   //mpi stuff
   if(mpi_io_proc()) fprintf(stdout, "GRID %s\n", fname);
 
-  //create hdf5
+  //create hdf5, keeping the geometry lossless
   hdf5_create(fname);
+  hdf5_set_filters(DUMP_DEFLATE, -1);
 
   //hdf5 directory
   hdf5_set_directory("/");
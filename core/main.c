@@ -13,16 +13,28 @@
 // more header files
 #include <time.h>
 #include <sys/stat.h>
+// signal.h declares a raise() of its own, which would clash with metric.c's
+#define raise signal_raise
+#include <signal.h>
+#undef raise
 
 // positron //
 #include "positrons.h"
 
+// Set by SIGTERM or SIGUSR1, acted on at the next step boundary
+static volatile sig_atomic_t stop_signal = 0;
+static void catch_stop_signal(int sig)
+{
+  stop_signal = sig;
+}
+
 // main body of the program
 int main(int argc, char *argv[])
 {
 
   //mpi stuff
   mpi_initialization(argc, argv);
+  double wall_start = omp_get_wtime();
 
   //print out license
   if (mpi_io_proc()) {
@@ -43,6 +55,8 @@ int main(int argc, char *argv[])
     fprintf(stdout, "          *                                                          *\n");
     fprintf(stdout, "          *    -p /path/to/param.dat                                 *\n");
     fprintf(stdout, "          *    -o /path/to/output/dir                                *\n");
+    fprintf(stdout, "          *    -b N   benchmark N steps, no I/O                      *\n");
+    fprintf(stdout, "          *    -w S   checkpoint and stop within S seconds          *\n");
     fprintf(stdout, "          *                                                          *\n");
     fprintf(stdout, "          ************************************************************\n\n");
   }
@@ -50,6 +64,8 @@ int main(int argc, char *argv[])
   // Read command line arguments, parameter files
   char pfname[STRLEN] = "param.dat";
   char outputdir[STRLEN] = ".";
+  int benchmark_steps = 0;
+  double walltime = 0.;
   for (int n = 0; n < argc; n++) {
     // Check for argv[n] of the form '-*'
     if (*argv[n] == '-' && *(argv[n]+1) != '\0' && *(argv[n]+2) == '\0' &&
@@ -57,9 +73,23 @@ int main(int argc, char *argv[])
       if (*(argv[n]+1) == 'o') { // Set output directory path
         strcpy(outputdir, argv[++n]);
       }
-      if (*(argv[n]+1) == 'p') { // Set parameter file path
+      else if (*(argv[n]+1) == 'p') { // Set parameter file path
         strcpy(pfname, argv[++n]);
       }
+      else if (*(argv[n]+1) == 'b') { // Benchmark a fixed number of steps
+        if (atoi(argv[n+1]) <= 0) {
+          fprintf(stderr, "-b needs a positive number of steps, not %s\n", argv[n+1]);
+          exit(-1);
+        }
+        benchmark_steps = atoi(argv[++n]);
+      }
+      else if (*(argv[n]+1) == 'w') { // Wallclock budget in seconds
+        if (atof(argv[n+1]) <= 0.) {
+          fprintf(stderr, "-w needs a positive number of seconds, not %s\n", argv[n+1]);
+          exit(-1);
+        }
+        walltime = atof(argv[++n]);
+      }
     }
   }
 
@@ -97,12 +127,9 @@ int main(int argc, char *argv[])
   }
   omp_set_num_threads(OMP_CORES);
 
-  ///////////////////////////////////////////////////////////////////////
-  // TODO centralize more allocations here with safe, aligned _mm_malloc
-  ///////////////////////////////////////////////////////////////////////
-  // allocate arrays
-  struct GridGeom *G = calloc(1,sizeof(struct GridGeom));
-  struct FluidState *S = calloc(1,sizeof(struct FluidState));
+  // allocate arrays, aligned, see memory.c
+  struct GridGeom *G = calloc_tracked(1,sizeof(struct GridGeom), "geometry");
+  struct FluidState *S = alloc_state(STATE_FULL, "state");
 
   // Leon's patch. calculate isco radius here //
   double z1 = 1 + pow(1 - a*a,1./3.)*(pow(1+a,1./3.) + pow(1-a,1./3.));
@@ -110,7 +137,8 @@ int main(int argc, char *argv[])
   R_isco = 3 + z2 - sqrt((3-z1)*(3 + z1 + 2*z2));
 
   // Perform initializations, either directly or via checkpoint
-  is_restart = restart_init(G, S);
+  // Benchmarks always start fresh, so repeated runs time the same steps
+  is_restart = benchmark_steps ? 0 : restart_init(G, S);
   if (!is_restart) {
     
     // Geneate initial conditions
@@ -146,11 +174,14 @@ int main(int argc, char *argv[])
 
   // In case we're restarting and these changed
   tdump = t + DTd;
+  tfull = t + DTf;
   tlog = t + DTl;
 
   // Initial diagnostics
-  diag(G, S, DIAG_INIT);
-  if (!is_restart) restart_write(S);
+  if (!benchmark_steps) {
+    diag(G, S, DIAG_INIT);
+    if (!is_restart) restart_write(S);
+  }
 
   //mpi stuff
   if (mpi_io_proc())
@@ -166,15 +197,44 @@ int main(int argc, char *argv[])
   if (mpi_io_proc())
     fprintf(stdout, "\nEntering main loop\n");
 
+  // Schedulers send these some time before killing a job
+  signal(SIGTERM, catch_stop_signal);
+  signal(SIGUSR1, catch_stop_signal);
+  double step_wall = 0.;
+  int memory_reported = 0;
+
   //initialize
   time_init();
   int dumpThisStep = 0;
+#if AVERAGES
+  average_init();
+#endif
+#ifdef OUTPUT_STREAMS
+  if (!benchmark_steps) stream_init();
+#endif
+
+  // Benchmarks take one untimed warm-up step, then benchmark_steps timed ones
+  int nstep_end = nstep + benchmark_steps + 1;
 
   //advance in time
-  while (t < tf) {
+  while (benchmark_steps ? nstep < nstep_end : t < tf) {
+
+    // Stop early for an abort file, a signal, or if another step and a
+    // restart might not fit in the walltime.  All processes stop together
+    double step_start = omp_get_wtime();
+    int stop = 0;
+    if (access(abort_fname, F_OK) != -1) {
+      stop = STOP_ABORT;
+    } else if (stop_signal) {
+      stop = STOP_SIGNAL;
+    } else if (walltime > 0. &&
+               step_start - wall_start + 2.*step_wall + restart_cost() > walltime) {
+      stop = STOP_WALLTIME;
+    }
+    stop = (int) mpi_max(stop);
 
     // Handle abort case
-    if ( access(abort_fname, F_OK) != -1 ) {
+    if (stop == STOP_ABORT) {
       if (mpi_io_proc()) {
         fprintf(stdout, "\nFound 'abort' file. Quitting now.\n\n");
       }
@@ -184,6 +244,21 @@ int main(int argc, char *argv[])
       return 0;
     }
 
+    // Otherwise leave a regular restart to pick up from
+    if (stop) {
+      if (mpi_io_proc()) {
+        if (stop == STOP_SIGNAL) fprintf(stdout, "\nCaught signal. Checkpointing and quitting.\n\n");
+        else fprintf(stdout, "\nOut of walltime. Checkpointing and quitting.\n\n");
+      }
+#if SHUTDOWN_DUMP
+      if (!dumpThisStep) diag(G, S, DIAG_FINAL);
+#endif
+      restart_write(S);
+      dump_wait();
+      mpi_finalize();
+      return 0;
+    }
+
     //set some stuff
     dumpThisStep = 0;
     timer_start(TIMER_ALL);
@@ -192,6 +267,22 @@ int main(int argc, char *argv[])
     step(G, S);
     nstep++;
 
+    // Work arrays are allocated on first use, so are all in place by now
+    if (!memory_reported) {
+      report_memory();
+      memory_reported = 1;
+    }
+#if AVERAGES
+    average_accumulate(G, S);
+#endif
+
+    if (benchmark_steps) {
+      timer_stop(TIMER_ALL);
+      // Restart the clocks after warm-up
+      if (nstep == nstep_end - benchmark_steps) time_init();
+      continue;
+    }
+
     // Don't step beyond end of run
     if (t + dt > tf) {
       dt = tf - t;
@@ -208,6 +299,7 @@ int main(int argc, char *argv[])
         dumpThisStep = 1;
         diag(G, S, DIAG_DUMP);
         tdump += DTd;
+        if (t >= tfull) tfull += DTf;
       }
       if (t >= tlog) {
         diag(G, S, DIAG_LOG);
@@ -215,6 +307,9 @@ int main(int argc, char *argv[])
       }
       if (nstep % DTr == 0)
         restart_write(S);
+#ifdef OUTPUT_STREAMS
+      stream_output(G, S);
+#endif
     }
 
     //count time
@@ -223,6 +318,13 @@ int main(int argc, char *argv[])
     //report code efficiencies
     if (nstep % DTp == 0)
       report_performance();
+#if STATUS_STEPS
+    if (nstep % STATUS_STEPS == 0)
+      report_status();
+#endif
+
+    // The longest step so far, I/O included
+    step_wall = MY_MAX(step_wall, omp_get_wtime() - step_start);
 //t = tf;
   }
   
@@ -232,8 +334,15 @@ int main(int argc, char *argv[])
 //*
 //*******************************************************************************
 
+  if (benchmark_steps) {
+    report_benchmark();
+    mpi_finalize();
+    return 0;
+  }
+
   // output diagonstic variables 
   if (dumpThisStep == 0) diag(G, S, DIAG_FINAL);
+  dump_wait();
 
   // mpi stuff
   mpi_finalize();
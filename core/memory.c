@@ -0,0 +1,195 @@
+//******************************************************************************
+//*                                                                            *
+//* MEMORY.C                                                                   *
+//*                                                                            *
+//* ARENA FOR LONG-LIVED ARRAYS AND SHARED SCRATCH, WITH A TALLY PER SUBSYSTEM *
+//*                                                                            *
+//******************************************************************************
+
+// import headers
+#include "decs.h"
+
+#include <ctype.h>
+#include <sys/mman.h>
+
+// Arrays of at least this size are mapped on their own, aligned to it
+#define HUGE_PAGE (2*1024*1024)
+
+// Bytes allocated under each subsystem name, in order of first use
+#define MAX_SUBSYSTEMS 32
+static const char *names[MAX_SUBSYSTEMS];
+static double bytes[MAX_SUBSYSTEMS];
+static int nsub = 0;
+
+// Bytes saved by allocating states without the fields they never use
+static double trimmed = 0.;
+
+// Scratch: one reservation, which every phase uses from its start.  Only the
+// pages up to the furthest any phase has reached are made accessible
+#define SCRATCH_RESERVE (4*sizeof(struct FluidState))
+static char *scratch = NULL;
+static size_t scratch_extent = 0;
+static size_t phase_used[NSCRATCH];
+static const char *phase_names[NSCRATCH];
+
+//******************************************************************************
+
+static void tally(const char *subsystem, double nbytes)
+{
+  int s = 0;
+  while (s < nsub && strcmp(names[s], subsystem) != 0) s++;
+  if (s == nsub) {
+    if (nsub == MAX_SUBSYSTEMS) {
+      fprintf(stderr, "Too many subsystems in the memory tally, raise MAX_SUBSYSTEMS\n");
+      exit(-1);
+    }
+    names[nsub++] = subsystem;
+  }
+  bytes[s] += nbytes;
+}
+
+static size_t round_up(size_t n, size_t to)
+{
+  return (n + to - 1)/to*to;
+}
+
+// Anonymous mapping of bytes aligned to HUGE_PAGE, advised onto transparent
+// huge pages.  Zeroed, and only backed as it is touched
+static void *map_aligned(size_t nbytes, int prot, int flags)
+{
+  nbytes = round_up(nbytes, HUGE_PAGE);
+  size_t len = nbytes + HUGE_PAGE;
+  char *p = mmap(NULL, len, prot, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+
+  // Trim to the aligned part
+  char *start = (char *) round_up((uintptr_t) p, HUGE_PAGE);
+  if (start > p) munmap(p, start - p);
+  if (p + len > start + nbytes) munmap(start + nbytes, p + len - (start + nbytes));
+
+#if ARENA_HUGEPAGES && defined(MADV_HUGEPAGE)
+  madvise(start, nbytes, MADV_HUGEPAGE);
+#endif
+  return start;
+}
+
+//******************************************************************************
+
+// Zeroed arrays kept for the whole run, counted against subsystem.  Aligned
+// to ARENA_ALIGN bytes, or to HUGE_PAGE if at least that large.
+// Exits if the allocation fails.  Called outside of parallel regions
+void *calloc_tracked(size_t n, size_t size, const char *subsystem)
+{
+  size_t nbytes = n*size;
+  void *p = NULL;
+  if (nbytes >= HUGE_PAGE) {
+    p = map_aligned(nbytes, PROT_READ | PROT_WRITE, 0);
+  } else if (posix_memalign(&p, ARENA_ALIGN, MY_MAX(nbytes, 1)) == 0) {
+    memset(p, 0, nbytes);
+  } else {
+    p = NULL;
+  }
+  if (p == NULL) {
+    fprintf(stderr, "Could not allocate %zu bytes for %s!\n", nbytes, subsystem);
+    exit(-1);
+  }
+  tally(subsystem, (double) nbytes);
+  return p;
+}
+
+// A zeroed FluidState with only the fields before size, one of STATE_PRIM,
+// STATE_CONS or STATE_FULL.  The fields past it must never be touched
+struct FluidState *alloc_state(size_t size, const char *subsystem)
+{
+  trimmed += sizeof(struct FluidState) - size;
+  return calloc_tracked(1, size, subsystem);
+}
+
+//******************************************************************************
+
+// Scratch for one phase of a step, one of SCRATCH_*.  Phases share memory,
+// so whatever a phase leaves in its scratch is overwritten by the next: use
+// this only for arrays written before they are read on every call.
+// Calls for one phase are laid out one after another, aligned to ARENA_ALIGN
+void *scratch_alloc(int phase, size_t nbytes, const char *subsystem)
+{
+  if (scratch == NULL) {
+    // Reserved without access, which costs no memory until it is granted
+    scratch = map_aligned(SCRATCH_RESERVE, PROT_NONE, MAP_NORESERVE);
+    if (scratch == NULL) {
+      fprintf(stderr, "Could not reserve scratch memory!\n");
+      exit(-1);
+    }
+  }
+
+  size_t offset = round_up(phase_used[phase], ARENA_ALIGN);
+  if (offset + nbytes > SCRATCH_RESERVE) {
+    fprintf(stderr, "Scratch for %s needs more than the %zu bytes reserved!\n",
+            subsystem, SCRATCH_RESERVE);
+    exit(-1);
+  }
+  phase_used[phase] = offset + nbytes;
+  if (phase_names[phase] == NULL) phase_names[phase] = subsystem;
+
+  size_t extent = round_up(phase_used[phase], getpagesize());
+  if (extent > scratch_extent) {
+    if (mprotect(scratch, extent, PROT_READ | PROT_WRITE) != 0) {
+      fprintf(stderr, "Could not allocate %zu bytes of scratch for %s!\n", extent, subsystem);
+      exit(-1);
+    }
+    scratch_extent = extent;
+  }
+
+  return scratch + offset;
+}
+
+// A FluidState in scratch, holding the fields before size as alloc_state()
+struct FluidState *scratch_state(int phase, size_t size, const char *subsystem)
+{
+  trimmed += sizeof(struct FluidState) - size;
+  return scratch_alloc(phase, size, subsystem);
+}
+
+//******************************************************************************
+
+// Print the allocations so far on this rank by subsystem, the scratch and
+// each phase's use of it, the zone flags and other static grids, and the
+// total over all ranks.  Collective
+void report_memory()
+{
+  double statics = 3.*sizeof(GridInt);
+#if ZONE_STATS
+  statics += sizeof(zone_stats);
+#endif
+#if COOLING
+  statics += 2.*sizeof(GridDouble);
+#endif
+#if VECPOT
+  statics += sizeof(GridDouble);
+#endif
+
+  double total = statics + scratch_extent, shared = 0.;
+  for (int s = 0; s < nsub; s++) total += bytes[s];
+  for (int n = 0; n < NSCRATCH; n++) shared += phase_used[n];
+  double total_all = mpi_reduce(total);
+
+  if (!mpi_io_proc()) return;
+
+  fprintf(stdout, "\n********** MEMORY (MB PER RANK) **********\n");
+  for (int s = 0; s < nsub; s++) {
+    char label[64];
+    snprintf(label, 64, "%s", names[s]);
+    for (char *l = label; *l; l++) *l = toupper(*l);
+    fprintf(stdout, "   %-16s %10.1f\n", label, bytes[s]/1.e6);
+  }
+  fprintf(stdout, "   %-16s %10.1f\n", "SCRATCH", scratch_extent/1.e6);
+  for (int n = 0; n < NSCRATCH; n++) {
+    if (phase_names[n] != NULL)
+      fprintf(stdout, "     %-14s %10.1f\n", phase_names[n], phase_used[n]/1.e6);
+  }
+  fprintf(stdout, "   %-16s %10.1f\n", "STATIC GRIDS", statics/1.e6);
+  fprintf(stdout, "   %-16s %10.1f\n", "TOTAL", total/1.e6);
+  fprintf(stdout, "   %-16s %10.1f\n", "ALL RANKS", total_all/1.e6);
+  fprintf(stdout, "   TRIMMED STATES SAVE %.1f, SHARED SCRATCH %.1f\n", trimmed/1.e6,
+          MY_MAX(shared - scratch_extent, 0.)/1.e6);
+}
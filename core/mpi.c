@@ -15,11 +15,14 @@
 //declare mpi variables
 static MPI_Comm comm;
 static int neighbors[3][3][3];
-static MPI_Datatype face_type[3];
-static MPI_Datatype pflag_face_type[3];
+static MPI_Datatype face_type[NVAR+1][NG+1][3];
+static MPI_Datatype pflag_face_type[NG+1][3];
+static int face_type_made[NVAR+1][NG+1];
+static int pflag_face_type_made[NG+1];
 static int rank;
 static int numprocs;
 static int comm_size;
+static int thread_multiple = 0;
 
 //**************************************************************************************8
 
@@ -35,17 +38,29 @@ void mpi_initialization(int argc, char *argv[])
       X1L_BOUND == PERIODIC && X1R_BOUND == PERIODIC};
 
   // Check for minimal required MPI thread support
+  // Communication and I/O threads need MPI_THREAD_MULTIPLE, but we can run without them
   int threadSafety;
+#if COMM_THREAD || ASYNC_IO
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &threadSafety);
+#else
   MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadSafety);
+#endif
   if (threadSafety < MPI_THREAD_FUNNELED) {
     fprintf(stderr, "Thread support < MPI_THREAD_FUNNELED. Unsafe.\n");
     exit(1);
   }
+  thread_multiple = (threadSafety >= MPI_THREAD_MULTIPLE);
 
   // Check that our communicator is the right size, and print
   // a user-friendly error if it is not
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &comm_size);
+
+#if COMM_THREAD
+  if (!thread_multiple && rank == 0) {
+    fprintf(stderr, "MPI library does not provide MPI_THREAD_MULTIPLE, disabling communication thread\n");
+  }
+#endif
   if (comm_size != numprocs) {
     if (rank == 0) {
       fprintf(stderr, "iharm3D is compiled to use %d MPI processes: N1CPU x N2CPU x N3CPU == %d x %d x %d == %d\n", numprocs, N1CPU, N2CPU, N3CPU, numprocs);
@@ -107,52 +122,7 @@ void mpi_initialization(int argc, char *argv[])
            global_start[2], global_stop[2]);
   }
 
-  // Make MPI datatypes
-  MPI_Datatype scalar_type = MPI_DOUBLE;
-  MPI_Datatype flag_type = MPI_INT;
-
-  // N3 face: Update all zones
-  // Need slice P[0-NVAR][i:i+NG][:][:]
-
-  int count = NVAR;
-  int countp = 1;
-  int block3 = NG*(N2+2*NG)*(N1+2*NG);
-  int stride3 = (N3+2*NG)*(N2+2*NG)*(N1+2*NG);
-
-  MPI_Type_vector(count, block3, stride3, scalar_type, &face_type[0]);
-  MPI_Type_commit(&face_type[0]);
-  MPI_Type_vector(countp, block3, stride3, flag_type, &pflag_face_type[0]);
-  MPI_Type_commit(&pflag_face_type[0]);
-
-  // N2 face: update all N1 zones, but only current good N3
-  // Slice P[0-NVAR][NG:N3+NG][i:i+NG][:]
-
-  int sizes[4] = {NVAR,N3+2*NG,N2+2*NG,N1+2*NG};
-  int subsizes2[4] = {NVAR,N3,NG,N1+2*NG};
-  int starts[4] = {0,0,0,0};
-  MPI_Type_create_subarray(4, sizes, subsizes2, starts,
-               MPI_ORDER_C, scalar_type, &face_type[1]);
-  MPI_Type_commit(&face_type[1]);
-
-  int sizes_pflag[3] = {N3+2*NG,N2+2*NG,N1+2*NG};
-  int subsizes2_pflag[3] = {N3,NG,N1+2*NG};
-  int starts_pflag[3] = {0,0,0};
-  MPI_Type_create_subarray(3, sizes_pflag, subsizes2_pflag, starts_pflag,
-               MPI_ORDER_C, flag_type, &pflag_face_type[1]);
-  MPI_Type_commit(&pflag_face_type[1]);
-
-  // N1 face: update only current good zones (No ghosts)
-  // Slice P[0-NVAR][NG:N3+NG][NG:N2+NG][i:i+NG]
-
-  int subsizes3[4] = {NVAR,N3,N2,NG};
-  MPI_Type_create_subarray(4, sizes, subsizes3, starts,
-               MPI_ORDER_C, scalar_type, &face_type[2]);
-  MPI_Type_commit(&face_type[2]);
-
-  int subsizes3_pflag[3] = {N3,N2,NG};
-  MPI_Type_create_subarray(3, sizes_pflag, subsizes3_pflag, starts_pflag,
-               MPI_ORDER_C, flag_type, &pflag_face_type[2]);
-  MPI_Type_commit(&pflag_face_type[2]);
+  // Face datatypes are made on first use, see make_face_types()
 
   MPI_Barrier(comm);
 }
@@ -166,23 +136,97 @@ void mpi_finalize()
 
 //**************************************************************************************
 
+// Whether threads other than the master may make MPI calls
+int mpi_thread_multiple()
+{
+  return thread_multiple;
+}
+
+//**************************************************************************************
+
+// Make the datatypes for a halo of the leading nvar primitives, depth zones deep
+// Each face covers the ghost zones already filled in the earlier directions,
+// so edges and corners are correct to the same depth
+static void make_face_types(int nvar, int depth)
+{
+  if (!face_type_made[nvar][depth]) {
+    int sizes[4] = {NVAR, N3+2*NG, N2+2*NG, N1+2*NG};
+    int starts[4] = {0,0,0,0};
+
+    // N3 face: Slice P[0-nvar][k:k+depth][NG-depth:N2+NG+depth][NG-depth:N1+NG+depth]
+    int subsizes1[4] = {nvar, depth, N2+2*depth, N1+2*depth};
+    MPI_Type_create_subarray(4, sizes, subsizes1, starts,
+                 MPI_ORDER_C, MPI_DOUBLE, &face_type[nvar][depth][0]);
+    MPI_Type_commit(&face_type[nvar][depth][0]);
+
+    // N2 face: only current good N3
+    // Slice P[0-nvar][NG:N3+NG][j:j+depth][NG-depth:N1+NG+depth]
+    int subsizes2[4] = {nvar, N3, depth, N1+2*depth};
+    MPI_Type_create_subarray(4, sizes, subsizes2, starts,
+                 MPI_ORDER_C, MPI_DOUBLE, &face_type[nvar][depth][1]);
+    MPI_Type_commit(&face_type[nvar][depth][1]);
+
+    // N1 face: update only current good zones (No ghosts)
+    // Slice P[0-nvar][NG:N3+NG][NG:N2+NG][i:i+depth]
+    int subsizes3[4] = {nvar, N3, N2, depth};
+    MPI_Type_create_subarray(4, sizes, subsizes3, starts,
+                 MPI_ORDER_C, MPI_DOUBLE, &face_type[nvar][depth][2]);
+    MPI_Type_commit(&face_type[nvar][depth][2]);
+
+    face_type_made[nvar][depth] = 1;
+  }
+
+  if (!pflag_face_type_made[depth]) {
+    int sizes_pflag[3] = {N3+2*NG, N2+2*NG, N1+2*NG};
+    int starts_pflag[3] = {0,0,0};
+
+    int subsizes1_pflag[3] = {depth, N2+2*depth, N1+2*depth};
+    MPI_Type_create_subarray(3, sizes_pflag, subsizes1_pflag, starts_pflag,
+                 MPI_ORDER_C, MPI_INT, &pflag_face_type[depth][0]);
+    MPI_Type_commit(&pflag_face_type[depth][0]);
+
+    int subsizes2_pflag[3] = {N3, depth, N1+2*depth};
+    MPI_Type_create_subarray(3, sizes_pflag, subsizes2_pflag, starts_pflag,
+                 MPI_ORDER_C, MPI_INT, &pflag_face_type[depth][1]);
+    MPI_Type_commit(&pflag_face_type[depth][1]);
+
+    int subsizes3_pflag[3] = {N3, N2, depth};
+    MPI_Type_create_subarray(3, sizes_pflag, subsizes3_pflag, starts_pflag,
+                 MPI_ORDER_C, MPI_INT, &pflag_face_type[depth][2]);
+    MPI_Type_commit(&pflag_face_type[depth][2]);
+
+    pflag_face_type_made[depth] = 1;
+  }
+}
+
+//**************************************************************************************
+
 // Share face data
-int sync_mpi_bound_X1(struct FluidState *S)
+// Only the leading nvar primitives are sent, depth zones deep, plus
+// pflag if sync_pflag is set
+int sync_mpi_bound_X1(struct FluidState *S, int nvar, int depth, int sync_pflag)
 {
 
   // We don't check returns since MPI kindly crashes on failure
 #if N1 > 1
+  make_face_types(nvar, depth);
+  MPI_Datatype type = face_type[nvar][depth][2];
+  MPI_Datatype ptype = pflag_face_type[depth][2];
+  int d = depth;
+
   // First send right/receive left
-  MPI_Sendrecv(&(S->P[0][NG][NG][N1]), 1, face_type[2], neighbors[1][1][2], 0,
-           &(S->P[0][NG][NG][0]), 1, face_type[2], neighbors[1][1][0], 0, comm, MPI_STATUS_IGNORE);
-  MPI_Sendrecv(&(pflag[NG][NG][N1]), 1, pflag_face_type[2], neighbors[1][1][2], 6,
-           &(pflag[NG][NG][0]), 1, pflag_face_type[2], neighbors[1][1][0], 6, comm, MPI_STATUS_IGNORE);
-           
+  MPI_Sendrecv(&(S->P[0][NG][NG][N1+NG-d]), 1, type, neighbors[1][1][2], 0,
+           &(S->P[0][NG][NG][NG-d]), 1, type, neighbors[1][1][0], 0, comm, MPI_STATUS_IGNORE);
+  if (sync_pflag)
+    MPI_Sendrecv(&(pflag[NG][NG][N1+NG-d]), 1, ptype, neighbors[1][1][2], 6,
+             &(pflag[NG][NG][NG-d]), 1, ptype, neighbors[1][1][0], 6, comm, MPI_STATUS_IGNORE);
+
   // And back
-  MPI_Sendrecv(&(S->P[0][NG][NG][NG]), 1, face_type[2], neighbors[1][1][0], 1,
-           &(S->P[0][NG][NG][N1+NG]), 1, face_type[2], neighbors[1][1][2], 1, comm, MPI_STATUS_IGNORE);
-  MPI_Sendrecv(&(pflag[NG][NG][NG]), 1, pflag_face_type[2], neighbors[1][1][0], 7,
-           &(pflag[NG][NG][N1+NG]), 1, pflag_face_type[2], neighbors[1][1][2], 7, comm, MPI_STATUS_IGNORE);
+  MPI_Sendrecv(&(S->P[0][NG][NG][NG]), 1, type, neighbors[1][1][0], 1,
+           &(S->P[0][NG][NG][N1+NG]), 1, type, neighbors[1][1][2], 1, comm, MPI_STATUS_IGNORE);
+  if (sync_pflag)
+    MPI_Sendrecv(&(pflag[NG][NG][NG]), 1, ptype, neighbors[1][1][0], 7,
+             &(pflag[NG][NG][N1+NG]), 1, ptype, neighbors[1][1][2], 7, comm, MPI_STATUS_IGNORE);
 #endif
 
   return 0;
@@ -190,19 +234,26 @@ int sync_mpi_bound_X1(struct FluidState *S)
 
 //**************************************************************************************
 
-int sync_mpi_bound_X2(struct FluidState *S)
+int sync_mpi_bound_X2(struct FluidState *S, int nvar, int depth, int sync_pflag)
 {
 
 #if N2 > 1
-  MPI_Sendrecv(&(S->P[0][NG][N2][0]), 1, face_type[1], neighbors[1][2][1], 2,
-           &(S->P[0][NG][0][0]), 1, face_type[1], neighbors[1][0][1], 2, comm, MPI_STATUS_IGNORE);
-  MPI_Sendrecv(&(pflag[NG][N2][0]), 1, pflag_face_type[1], neighbors[1][2][1], 8,
-           &(pflag[NG][0][0]), 1, pflag_face_type[1], neighbors[1][0][1], 8, comm, MPI_STATUS_IGNORE);
-
-  MPI_Sendrecv(&(S->P[0][NG][NG][0]), 1, face_type[1], neighbors[1][0][1], 3,
-           &(S->P[0][NG][N2+NG][0]), 1, face_type[1], neighbors[1][2][1], 3, comm, MPI_STATUS_IGNORE);
-  MPI_Sendrecv(&(pflag[NG][NG][0]), 1, pflag_face_type[1], neighbors[1][0][1], 9,
-           &(pflag[NG][N2+NG][0]), 1, pflag_face_type[1], neighbors[1][2][1], 9, comm, MPI_STATUS_IGNORE);
+  make_face_types(nvar, depth);
+  MPI_Datatype type = face_type[nvar][depth][1];
+  MPI_Datatype ptype = pflag_face_type[depth][1];
+  int d = depth;
+
+  MPI_Sendrecv(&(S->P[0][NG][N2+NG-d][NG-d]), 1, type, neighbors[1][2][1], 2,
+           &(S->P[0][NG][NG-d][NG-d]), 1, type, neighbors[1][0][1], 2, comm, MPI_STATUS_IGNORE);
+  if (sync_pflag)
+    MPI_Sendrecv(&(pflag[NG][N2+NG-d][NG-d]), 1, ptype, neighbors[1][2][1], 8,
+             &(pflag[NG][NG-d][NG-d]), 1, ptype, neighbors[1][0][1], 8, comm, MPI_STATUS_IGNORE);
+
+  MPI_Sendrecv(&(S->P[0][NG][NG][NG-d]), 1, type, neighbors[1][0][1], 3,
+           &(S->P[0][NG][N2+NG][NG-d]), 1, type, neighbors[1][2][1], 3, comm, MPI_STATUS_IGNORE);
+  if (sync_pflag)
+    MPI_Sendrecv(&(pflag[NG][NG][NG-d]), 1, ptype, neighbors[1][0][1], 9,
+             &(pflag[NG][N2+NG][NG-d]), 1, ptype, neighbors[1][2][1], 9, comm, MPI_STATUS_IGNORE);
 #endif
 
   return 0;
@@ -210,19 +261,26 @@ int sync_mpi_bound_X2(struct FluidState *S)
 
 //**************************************************************************************
 
-int sync_mpi_bound_X3(struct FluidState *S)
+int sync_mpi_bound_X3(struct FluidState *S, int nvar, int depth, int sync_pflag)
 {
 
 #if N3 > 1
-  MPI_Sendrecv(&(S->P[0][N3][0][0]), 1, face_type[0], neighbors[2][1][1], 4,
-           &(S->P[0][0][0][0]), 1, face_type[0], neighbors[0][1][1], 4, comm, MPI_STATUS_IGNORE);
-  MPI_Sendrecv(&(pflag[N3][0][0]), 1, pflag_face_type[0], neighbors[2][1][1], 10,
-           &(pflag[0][0][0]), 1, pflag_face_type[0], neighbors[0][1][1], 10, comm, MPI_STATUS_IGNORE);
-
-  MPI_Sendrecv(&(S->P[0][NG][0][0]), 1, face_type[0], neighbors[0][1][1], 5,
-           &(S->P[0][N3+NG][0][0]), 1, face_type[0], neighbors[2][1][1], 5, comm, MPI_STATUS_IGNORE);
-  MPI_Sendrecv(&(pflag[NG][0][0]), 1, pflag_face_type[0], neighbors[0][1][1], 11,
-           &(pflag[N3+NG][0][0]), 1, pflag_face_type[0], neighbors[2][1][1], 11, comm, MPI_STATUS_IGNORE);
+  make_face_types(nvar, depth);
+  MPI_Datatype type = face_type[nvar][depth][0];
+  MPI_Datatype ptype = pflag_face_type[depth][0];
+  int d = depth;
+
+  MPI_Sendrecv(&(S->P[0][N3+NG-d][NG-d][NG-d]), 1, type, neighbors[2][1][1], 4,
+           &(S->P[0][NG-d][NG-d][NG-d]), 1, type, neighbors[0][1][1], 4, comm, MPI_STATUS_IGNORE);
+  if (sync_pflag)
+    MPI_Sendrecv(&(pflag[N3+NG-d][NG-d][NG-d]), 1, ptype, neighbors[2][1][1], 10,
+             &(pflag[NG-d][NG-d][NG-d]), 1, ptype, neighbors[0][1][1], 10, comm, MPI_STATUS_IGNORE);
+
+  MPI_Sendrecv(&(S->P[0][NG][NG-d][NG-d]), 1, type, neighbors[0][1][1], 5,
+           &(S->P[0][N3+NG][NG-d][NG-d]), 1, type, neighbors[2][1][1], 5, comm, MPI_STATUS_IGNORE);
+  if (sync_pflag)
+    MPI_Sendrecv(&(pflag[NG][NG-d][NG-d]), 1, ptype, neighbors[0][1][1], 11,
+             &(pflag[N3+NG][NG-d][NG-d]), 1, ptype, neighbors[2][1][1], 11, comm, MPI_STATUS_IGNORE);
 #endif
 
   return 0;
@@ -266,6 +324,25 @@ double mpi_min(double f)
 
 //**************************************************************************************
 
+// Non-blocking minimum, so the timestep reduction can overlap with the
+// fixups and boundary work at the end of a step.  Only one may be in flight
+static MPI_Request min_request = MPI_REQUEST_NULL;
+static double min_send, min_recv;
+
+void mpi_min_start(double f)
+{
+  min_send = f;
+  MPI_Iallreduce(&min_send, &min_recv, 1, MPI_DOUBLE, MPI_MIN, comm, &min_request);
+}
+
+double mpi_min_wait()
+{
+  MPI_Wait(&min_request, MPI_STATUS_IGNORE);
+  return min_recv;
+}
+
+//**************************************************************************************
+
 double mpi_reduce(double f) {
 
   double local;
@@ -284,6 +361,15 @@ int mpi_reduce_int(int f) {
 
 //**************************************************************************************
 
+uint64_t mpi_reduce_uint64(uint64_t f) {
+
+  uint64_t local;
+  MPI_Allreduce(&f, &local, 1, MPI_UINT64_T, MPI_SUM, comm);
+  return local;
+}
+
+//**************************************************************************************
+
 void mpi_reduce_vector(double *vec_send, double *vec_recv, int len)
 {
   MPI_Allreduce(vec_send, vec_recv, len, MPI_DOUBLE, MPI_SUM, comm);
@@ -291,6 +377,40 @@ void mpi_reduce_vector(double *vec_send, double *vec_recv, int len)
 
 //**************************************************************************************
 
+// Sum over the processes sharing this one's x1,x2 block, onto the one at the lowest x3.
+// Returns whether this process is that one
+int mpi_reduce_x3(double *vec_send, double *vec_recv, int len)
+{
+  static MPI_Comm x3_comm;
+  static int firstc = 1;
+  if (firstc) {
+    int remain[3] = {1, 0, 0};
+    MPI_Cart_sub(comm, remain, &x3_comm);
+    firstc = 0;
+  }
+
+  int x3_rank;
+  MPI_Comm_rank(x3_comm, &x3_rank);
+  MPI_Reduce(vec_send, vec_recv, len, MPI_DOUBLE, MPI_SUM, 0, x3_comm);
+  return x3_rank == 0;
+}
+
+//**************************************************************************************
+
+void mpi_min_vector(double *vec_send, double *vec_recv, int len)
+{
+  MPI_Allreduce(vec_send, vec_recv, len, MPI_DOUBLE, MPI_MIN, comm);
+}
+
+//**************************************************************************************
+
+void mpi_max_vector(double *vec_send, double *vec_recv, int len)
+{
+  MPI_Allreduce(vec_send, vec_recv, len, MPI_DOUBLE, MPI_MAX, comm);
+}
+
+//**************************************************************************************
+
 void mpi_int_broadcast(int *val)
 {
   MPI_Bcast(val, 1, MPI_INT, 0, comm);
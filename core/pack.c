@@ -14,37 +14,116 @@
 
 //*****************************************************************************************************8
 
-// Reverse and write a backwards-index N{3,2,1}-size array of doubles (GridDouble) to a file
-void pack_write_scalar(double in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name, hsize_t hdf5_type)
+// Output buffer, reused between calls and grown to the largest request
+static void *pack_buffer(size_t size)
+{
+  static void *buf = NULL;
+  static size_t buf_size = 0;
+  if (size > buf_size) {
+    free(buf);
+    buf = malloc(size);
+    if (buf == NULL) {
+      fprintf(stderr, "Could not allocate output buffer!\n");
+      exit(-1);
+    }
+    buf_size = size;
+  }
+  return buf;
+}
+
+// Reverse the interior of in[mu][k][j][i] into out[i][j][k][mu], in parallel.
+// Tiles in i and k keep both the reads along i and the writes along k in cache
+#define PACK_BLOCK 16
+#define PACK_TRANSPOSE(type, out, in, len) \
+  _Pragma("omp parallel for collapse(2)") \
+  for (int jj = 0; jj < N2; jj++) \
+  for (int ib = 0; ib < N1; ib += PACK_BLOCK) \
+  for (int kb = 0; kb < N3; kb += PACK_BLOCK) \
+  for (int ii = ib; ii < MY_MIN(ib + PACK_BLOCK, N1); ii++) \
+  for (int kk = kb; kk < MY_MIN(kb + PACK_BLOCK, N3); kk++) \
+  for (int mu = 0; mu < (len); mu++) \
+    ((type*) (out))[((ii*N2 + jj)*N3 + kk)*(len) + mu] = (type) (in)[mu][kk+NG][jj+NG][ii+NG];
+
+// Copy the interior of in[mu][k][j][i] into out[mu][k][j][i] without reordering
+#define PACK_NATIVE(type, out, in, len) \
+  _Pragma("omp parallel for collapse(3)") \
+  for (int mu = 0; mu < (len); mu++) \
+  for (int kk = 0; kk < N3; kk++) \
+  for (int jj = 0; jj < N2; jj++) \
+  for (int ii = 0; ii < N1; ii++) \
+    ((type*) (out))[((mu*N3 + kk)*N2 + jj)*N1 + ii] = (type) (in)[mu][kk+NG][jj+NG][ii+NG];
+
+// Label native-order datasets with their index order, slowest first.
+// Datasets without the attribute are in the usual x1,x2,x3[,var] order
+#if DUMP_NATIVE_ORDER
+static void pack_add_order(const char *name, const char *order)
 {
-  void *out = calloc(N1*N2*N3, sizeof(hdf5_type));
+  hid_t string_type = H5Tcopy(H5T_C_S1);
+  H5Tset_size(string_type, strlen(order)+1);
+  hdf5_add_attr(order, "dim_order", name, string_type);
+  H5Tclose(string_type);
+}
+#endif
 
-  // Do some ungodly things with casts
-  // Please keep this code away from children
-  int ind = 0;
+//*****************************************************************************************************
+
+// One variable of a Grid* array, so vectors can be written from any subset of their variables
+typedef double (*PackRow)[N2+2*NG][N1+2*NG];
+
+// Write len N{3,2,1}-size arrays of doubles, reversed to x1,x2,x3,len order unless DUMP_NATIVE_ORDER
+static void pack_write_doubles(PackRow in[], int len, int rank, const char* name, hsize_t hdf5_type)
+{
+  size_t size;
   if (hdf5_type == H5T_IEEE_F64LE) {
-    ZLOOP_OUT {
-      ((double*) out)[ind] = in[k][j][i];
-      ind++;
-    }
+    size = sizeof(double);
   } else if (hdf5_type == H5T_IEEE_F32LE) {
-    ZLOOP_OUT {
-      ((float*) out)[ind] = (float) in[k][j][i];
-      ind++;
-    }
+    size = sizeof(float);
   } else {
     fprintf(stderr, "Scalar type not supported!\n\n");
     exit(-1);
   }
+  void *out = pack_buffer(N1*N2*N3*len*size);
 
-  hsize_t fdims[] = {N1TOT, N2TOT, N3TOT};
-  hsize_t fstart[] = {global_start[0], global_start[1], global_start[2]};
-  hsize_t fcount[] = {N1, N2, N3}; // = mdims since this was packed above
-  hsize_t mstart[] = {0, 0, 0};
+#if DUMP_NATIVE_ORDER
+  if (hdf5_type == H5T_IEEE_F64LE) {
+    PACK_NATIVE(double, out, in, len);
+  } else {
+    PACK_NATIVE(float, out, in, len);
+  }
 
-  hdf5_write_array(out, name, 3, fdims, fstart, fcount, fcount, mstart, hdf5_type);
+  // Scalars drop the leading var index
+  hsize_t fdims[] = {len, N3TOT, N2TOT, N1TOT};
+  hsize_t fstart[] = {0, global_start[2], global_start[1], global_start[0]};
+  hsize_t fcount[] = {len, N3, N2, N1};
+  hsize_t mstart[] = {0, 0, 0, 0};
+  int off = 4 - rank;
 
-  free(out);
+  hdf5_write_array(out, name, rank, fdims+off, fstart+off, fcount+off, fcount+off, mstart+off, hdf5_type);
+  pack_add_order(name, (rank == 3) ? "x3,x2,x1" : "var,x3,x2,x1");
+#else
+  if (hdf5_type == H5T_IEEE_F64LE) {
+    PACK_TRANSPOSE(double, out, in, len);
+  } else {
+    PACK_TRANSPOSE(float, out, in, len);
+  }
+
+  // Scalars drop the trailing var index
+  hsize_t fdims[] = {N1TOT, N2TOT, N3TOT, len};
+  hsize_t fstart[] = {global_start[0], global_start[1], global_start[2], 0};
+  hsize_t fcount[] = {N1, N2, N3, len}; // = mdims since this was packed above
+  hsize_t mstart[] = {0, 0, 0, 0};
+
+  hdf5_write_array(out, name, rank, fdims, fstart, fcount, fcount, mstart, hdf5_type);
+#endif
+}
+
+//*****************************************************************************************************
+
+// Reverse and write a backwards-index N{3,2,1}-size array of doubles (GridDouble) to a file
+void pack_write_scalar(double in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name, hsize_t hdf5_type)
+{
+  PackRow rows[1] = {in};
+  pack_write_doubles(rows, 1, 3, name, hdf5_type);
 }
 
 //*****************************************************************************************************
@@ -52,13 +131,21 @@ void pack_write_scalar(double in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name, h
 // Reverse and write a backwards-index N{3,2,1}-size array of ints (GridInt) to a file
 void pack_write_int(int in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name)
 {
-  int *out = calloc(N1*N2*N3, sizeof(int));
+  int (*v)[N3+2*NG][N2+2*NG][N1+2*NG] = (int (*)[N3+2*NG][N2+2*NG][N1+2*NG]) in;
+  int *out = pack_buffer(N1*N2*N3*sizeof(int));
 
-  int ind = 0;
-  ZLOOP_OUT {
-    out[ind] = in[k][j][i];
-    ind++;
-  }
+#if DUMP_NATIVE_ORDER
+  PACK_NATIVE(int, out, v, 1);
+
+  hsize_t fdims[] = {N3TOT, N2TOT, N1TOT};
+  hsize_t fstart[] = {global_start[2], global_start[1], global_start[0]};
+  hsize_t fcount[] = {N3, N2, N1};
+  hsize_t mstart[] = {0, 0, 0};
+
+  hdf5_write_array(out, name, 3, fdims, fstart, fcount, fcount, mstart, H5T_STD_I32LE);
+  pack_add_order(name, "x3,x2,x1");
+#else
+  PACK_TRANSPOSE(int, out, v, 1);
 
   hsize_t fdims[] = {N1TOT, N2TOT, N3TOT};
   hsize_t fstart[] = {global_start[0], global_start[1], global_start[2]};
@@ -66,8 +153,7 @@ void pack_write_int(int in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name)
   hsize_t mstart[] = {0, 0, 0};
 
   hdf5_write_array(out, name, 3, fdims, fstart, fcount, fcount, mstart, H5T_STD_I32LE);
-
-  free(out);
+#endif
 }
 
 //*****************************************************************************************************
@@ -75,36 +161,20 @@ void pack_write_int(int in[N3+2*NG][N2+2*NG][N1+2*NG], const char* name)
 // Reverse and write a backwards-index len,N{3,2,1}-size array of ints (GridVector or GridPrim) to a file
 void pack_write_vector(double in[][N3+2*NG][N2+2*NG][N1+2*NG], int len, const char* name, hsize_t hdf5_type)
 {
-  void *out = calloc(N1*N2*N3*len, sizeof(hdf5_type));
-
-  int ind = 0;
-  if (hdf5_type == H5T_IEEE_F64LE) {
-    ZLOOP_OUT {
-      for (int mu=0; mu < len; mu++) {
-        ((double*) out)[ind] = in[mu][k][j][i];
-        ind++;
-      }
-    }
-  } else if (hdf5_type == H5T_IEEE_F32LE) {
-    ZLOOP_OUT {
-      for (int mu=0; mu < len; mu++) {
-        ((float*) out)[ind] = (float) in[mu][k][j][i];
-        ind++;
-      }
-    }
-  } else {
-    fprintf(stderr, "Scalar type not supported!\n\n");
-    exit(-1);
-  }
-
-  hsize_t fdims[] = {N1TOT, N2TOT, N3TOT, len};
-  hsize_t fstart[] = {global_start[0], global_start[1], global_start[2], 0};
-  hsize_t fcount[] = {N1, N2, N3, len};
-  hsize_t mstart[] = {0, 0, 0, 0};
+  PackRow rows[len];
+  for (int mu = 0; mu < len; mu++) rows[mu] = in[mu];
+  pack_write_doubles(rows, len, 4, name, hdf5_type);
+}
 
-  hdf5_write_array(out, name, 4, fdims, fstart, fcount, fcount, mstart, hdf5_type);
+//*****************************************************************************************************
 
-  free(out);
+// As pack_write_vector, for only the len variables listed in vars
+void pack_write_prims(double in[][N3+2*NG][N2+2*NG][N1+2*NG], int len, const int *vars, const char* name,
+                      hsize_t hdf5_type)
+{
+  PackRow rows[len];
+  for (int n = 0; n < len; n++) rows[n] = in[vars[n]];
+  pack_write_doubles(rows, len, 4, name, hdf5_type);
 }
 
 //*****************************************************************************************************
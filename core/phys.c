@@ -363,7 +363,7 @@ inline void get_fluid_source(struct GridGeom *G, struct FluidState *S, GridPrim
 #if WIND_TERM
   static struct FluidState *dS;
   static int firstc = 1;
-  if (firstc) {dS = calloc(1,sizeof(struct FluidState)); firstc = 0;}
+  if (firstc) {dS = alloc_state(STATE_CONS, "sources"); firstc = 0;}
 #endif
 
 #pragma omp parallel for collapse(3)
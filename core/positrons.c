@@ -248,6 +248,12 @@ inline void pair_production_1zone(struct GridGeom *G, struct FluidState *Ss, str
         }
       }
 
+#if ZONE_STATS
+      /* bracketing and bisection steps */
+      zone_stats[ZS_PAIR_IMPLICIT][k][j][i]++;
+      zone_stats[ZS_PAIR_SOLVE][k][j][i] += o + 1 + count + 1;
+#endif
+
       /* exit if no solution, and print out error */
       if(count == 99999) {
         printf("No solution\n");
@@ -261,6 +267,10 @@ inline void pair_production_1zone(struct GridGeom *G, struct FluidState *Ss, str
     /* otherwise, march forward by time */
     } else {
 
+#if ZONE_STATS
+      zone_stats[ZS_PAIR_EXPLICIT][k][j][i]++;
+#endif
+
       // positron mass production rate, need to convert to code unit!!! //
       npost = npost + net_rate*dt_real;
     
@@ -275,6 +285,12 @@ inline void pair_production_1zone(struct GridGeom *G, struct FluidState *Ss, str
 
     // update positron mass //
     Sf->P[RPL][k][j][i] = npost*(ME/RHO_unit);
+
+    // and keep its conserved variable in step, for the next step //
+    // U[RPL]/P[RPL] = U[RHO]/P[RHO] = u^0 sqrt(-g) //
+#if KEEP_CONSERVED
+    Sf->U[RPL][k][j][i] = Sf->P[RPL][k][j][i]*Sf->U[RHO][k][j][i]/Sf->P[RHO][k][j][i];
+#endif
   }
 }
 
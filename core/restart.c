@@ -16,6 +16,7 @@
 //include extra header files
 #include <sys/stat.h>
 #include <ctype.h>
+#include <dirent.h>
 
 // positron //
 #include "positrons.h"
@@ -23,40 +24,116 @@
 // declare variables
 static int restart_id = 0;
 
+// Longest time taken to write a restart file so far
+static double restart_wall = 0.;
+
+// Whether the restart read was moved onto this grid
+static int regridded = 0;
+
+// Whether the conserved variables were read back too (KEEP_CONSERVED)
+static int kept_u = 0;
+
 // Declare known sizes for outputting primitives
 static hsize_t fdims[] = {NVAR, N3TOT, N2TOT, N1TOT};
 static hsize_t fcount[] = {NVAR, N3, N2, N1};
 static hsize_t mdims[] = {NVAR, N3+2*NG, N2+2*NG, N1+2*NG};
 static hsize_t mstart[] = {0, NG, NG, NG};
 
+// Grid flag recorded alongside the physics flags
+#if DEREFINE_POLES
+static const int derefine_poles = 1;
+#else
+static const int derefine_poles = 0;
+#endif
+
+// Everything a restart file needs from the run, taken at the time of writing
+struct RestartStage {
+  GridPrim *P;
+  GridPrim *U;
+  GridInt *uflag;
+  double t, dt, tdump, tlog;
+  int nstep, restart_id, dump_cnt, type, busy;
+  uint64_t checksum;
+  double wall;
+  char fname[STRLEN];
+};
+
 //******************************************************************************
 
-void restart_write(struct FluidState *S) 
+// Checksum of the prims, independent of the decomposition: a sum of hashes of
+// each value together with its global position.  Collective
+static inline uint64_t zone_hash(uint64_t zone, int ip, double v)
 {
-  restart_write_backend(S, IO_REGULAR);
+  uint64_t h;
+  memcpy(&h, &v, sizeof(h));
+  h ^= (zone*NVAR + ip)*0x9E3779B97F4A7C15ULL;
+  // splitmix64 finalizer
+  h = (h ^ (h >> 30))*0xBF58476D1CE4E5B9ULL;
+  h = (h ^ (h >> 27))*0x94D049BB133111EBULL;
+  return h ^ (h >> 31);
+}
+
+static uint64_t prims_checksum(GridPrim *P)
+{
+  uint64_t sum = 0;
+#pragma omp parallel for collapse(3) reduction(+:sum)
+  ZLOOP {
+    uint64_t zone = ((uint64_t) (k - NG + global_start[2])*N2TOT +
+                     (j - NG + global_start[1]))*N1TOT + (i - NG + global_start[0]);
+    PLOOP sum += zone_hash(zone, ip, (*P)[ip][k][j][i]);
+  }
+  return mpi_reduce_uint64(sum);
+}
+
+// Sort newest first
+static int id_cmp(const void *a, const void *b)
+{
+  return *(const int *) b - *(const int *) a;
+}
+
+// Indices of the regular restart files on disk, newest first.
+// Returns how many, in a list *ids the caller frees
+static int restart_list(int **ids)
+{
+  int n = 0, len = 16;
+  *ids = malloc(len*sizeof(int));
+  DIR *dir = opendir("restarts");
+  if (dir == NULL) return 0;
+
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    int id;
+    char end[4];
+    if (sscanf(ent->d_name, "restart_%8d.%3s", &id, end) == 2 && strcmp(end, "h5") == 0 &&
+        strlen(ent->d_name) == strlen("restart_00000000.h5")) {
+      if (n == len) *ids = realloc(*ids, (len *= 2)*sizeof(int));
+      (*ids)[n++] = id;
+    }
+  }
+  closedir(dir);
+
+  qsort(*ids, n, sizeof(int), id_cmp);
+  return n;
 }
 
 //******************************************************************************
 
-// write out restart file
-void restart_write_backend(struct FluidState *S, int type)
+void restart_write(struct FluidState *S) 
 {
-  // count time
-  timer_start(TIMER_RESTART);
+  restart_write_backend(S, IO_REGULAR);
+}
 
-  // Keep track of our own index
-  restart_id++;
+//******************************************************************************
 
-  // read restart file
-  char fname[STRLEN];
-  if (type == IO_REGULAR) {
-    sprintf(fname, "restarts/restart_%08d.h5", restart_id);
-  } else if (type == IO_ABORT) {
-    sprintf(fname, "restarts/restart_abort.h5");
-  }
+// write a staged restart to its file, then point restart.last at it
+static void restart_write_stage(void *arg)
+{
+  struct RestartStage *r = (struct RestartStage *) arg;
+  double wall_start = omp_get_wtime();
 
-  //create hdf5 file
-  hdf5_create(fname);
+  //create hdf5 file, only ever compressed losslessly
+  hdf5_create(r->fname);
+  hdf5_set_filters(RESTART_DEFLATE, -1);
 
   // Write header and primitive values all to root
   hdf5_set_directory("/");
@@ -71,9 +148,27 @@ void restart_write_backend(struct FluidState *S, int type)
   hdf5_write_single_val(&n2, "n2", H5T_STD_I32LE);
   hdf5_write_single_val(&n3, "n3", H5T_STD_I32LE);
 
+  // Physics the primitives were evolved with, checked on import
+  int n_prim = NVAR, has_electrons = ELECTRONS, allmodels = ALLMODELS;
+  int has_positrons = POSITRONS, metric = METRIC;
+  hdf5_write_single_val(&n_prim, "n_prim", H5T_STD_I32LE);
+  hdf5_write_single_val(&has_electrons, "has_electrons", H5T_STD_I32LE);
+  hdf5_write_single_val(&allmodels, "allmodels", H5T_STD_I32LE);
+  hdf5_write_single_val(&has_positrons, "has_positrons", H5T_STD_I32LE);
+  hdf5_write_single_val(&metric, "metric", H5T_STD_I32LE);
+  hdf5_write_single_val(&derefine_poles, "derefine_poles", H5T_STD_I32LE);
+
+  // Layout of the writer.  Informational only: "p" is stored in global index
+  // order, so any decomposition/thread count can read it back
+  int n1cpu = N1CPU, n2cpu = N2CPU, n3cpu = N3CPU;
+  hdf5_write_single_val(&n1cpu, "n1cpu", H5T_STD_I32LE);
+  hdf5_write_single_val(&n2cpu, "n2cpu", H5T_STD_I32LE);
+  hdf5_write_single_val(&n3cpu, "n3cpu", H5T_STD_I32LE);
+  hdf5_write_single_val(&nthreads, "nthreads", H5T_STD_I32LE);
+
   // time, number of step, final time, gas constants
-  hdf5_write_single_val(&t, "t", H5T_IEEE_F64LE);
-  hdf5_write_single_val(&nstep, "nstep", H5T_STD_I32LE);
+  hdf5_write_single_val(&r->t, "t", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&r->nstep, "nstep", H5T_STD_I32LE);
   hdf5_write_single_val(&tf, "tf", H5T_IEEE_F64LE);
   hdf5_write_single_val(&gam, "gam", H5T_IEEE_F64LE);
 
@@ -91,9 +186,9 @@ void restart_write_backend(struct FluidState *S, int type)
   hdf5_write_single_val(&DTl, "DTl", H5T_IEEE_F64LE);
   hdf5_write_single_val(&DTr, "DTr", H5T_STD_I32LE);
   hdf5_write_single_val(&DTp, "DTp", H5T_STD_I32LE);
-  hdf5_write_single_val(&restart_id, "restart_id", H5T_STD_I32LE);
-  hdf5_write_single_val(&dump_cnt, "dump_cnt", H5T_STD_I32LE);
-  hdf5_write_single_val(&dt, "dt", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&r->restart_id, "restart_id", H5T_STD_I32LE);
+  hdf5_write_single_val(&r->dump_cnt, "dump_cnt", H5T_STD_I32LE);
+  hdf5_write_single_val(&r->dt, "dt", H5T_IEEE_F64LE);
 
   // grid variables
 #if METRIC == MKS
@@ -122,48 +217,442 @@ void restart_write_backend(struct FluidState *S, int type)
   //////////////////////////////////////////////////////////////////////////////////////////////
   // TODO these are unused.  Stop writing them when backward compatibility will not be an issue
   //////////////////////////////////////////////////////////////////////////////////////////////
-  hdf5_write_single_val(&tdump, "tdump", H5T_IEEE_F64LE);
-  hdf5_write_single_val(&tlog, "tlog", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&r->tdump, "tdump", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&r->tlog, "tlog", H5T_IEEE_F64LE);
 
   // Write data
   // As this is not packed, the read_restart_prims fn is different per-code
   hsize_t fstart[] = {0, global_start[2], global_start[1], global_start[0]};
-  hdf5_write_array(S->P, "p", 4, fdims, fstart, fcount, mdims, mstart, H5T_IEEE_F64LE);
-  
+  hdf5_write_array(*r->P, "p", 4, fdims, fstart, fcount, mdims, mstart, H5T_IEEE_F64LE);
+
+#if KEEP_CONSERVED
+  // The kept conserved variables and the zones due to be recalculated from
+  // the prims, so that a restarted run goes on exactly as this one would
+  hdf5_write_array(*r->U, "u", 4, fdims, fstart, fcount, mdims, mstart, H5T_IEEE_F64LE);
+  hdf5_write_array(*r->uflag, "uflag", 3, fdims + 1, fstart + 1, fcount + 1, mdims + 1, mstart + 1,
+                   H5T_STD_I32LE);
+#endif
+
+  // Checked against the prims on reading
+  hdf5_write_single_val(&r->checksum, "checksum", H5T_STD_U64LE);
+
   //close hdf5 files
   hdf5_close();
 
   //mpi stuff
   if(mpi_io_proc()) {
-    fprintf(stdout, "RESTART %s\n", fname);
-
-    // Symlink when we're done writing (link to last good file)
-    char fname_nofolder[80];
-    sprintf(fname_nofolder, "restart_%08d.h5", restart_id);
-
-    // Chained OS functions: switch to restart directory,
-    // remove current link, link last file, switch back
-    int errcode;
-    errcode = chdir("restarts");
-    if ( access("restart.last", F_OK) != -1 ) {
-      errcode = errcode || remove("restart.last");
-    }
-    errcode = errcode || symlink(fname_nofolder, "restart.last");
-    errcode = errcode || chdir("..");
-    if(errcode != 0) {
+    fprintf(stdout, "RESTART %s\n", r->fname);
+
+    // Link to last good file.  The new link is made alongside and renamed
+    // over the old one, so restart.last is never missing or dangling
+    const char *fname_nofolder = strrchr(r->fname, '/') + 1;
+    remove("restarts/restart.last.tmp");
+    if (symlink(fname_nofolder, "restarts/restart.last.tmp") != 0 ||
+        rename("restarts/restart.last.tmp", "restarts/restart.last") != 0) {
       printf("Symlink failed: errno %d\n", errno);
       exit(-1);
     }
+
+    // Retire restarts beyond the last RESTART_KEEP
+    if (RESTART_KEEP > 0 && r->type == IO_REGULAR) {
+      int *ids, n = restart_list(&ids);
+      for (int m = 0; m < n; m++) {
+        if (ids[m] <= r->restart_id - RESTART_KEEP) {
+          char old[STRLEN];
+          sprintf(old, "restarts/restart_%08d.h5", ids[m]);
+          remove(old);
+        }
+      }
+      free(ids);
+    }
   }
 
+  r->wall = omp_get_wtime() - wall_start;
+}
+
+//******************************************************************************
+
+// write out restart file
+void restart_write_backend(struct FluidState *S, int type)
+{
+  // count time
+  timer_start(TIMER_RESTART);
+
+  // Writing from the I/O thread, the prims are copied out so the run can go on
+  static struct RestartStage stage;
+  static int firstc = 1;
+  if (firstc) {
+    if (io_async()) stage.P = calloc_tracked(1,sizeof(GridPrim), "io");
+#if KEEP_CONSERVED
+    if (io_async()) {
+      stage.U = calloc_tracked(1, sizeof(GridPrim), "io");
+      stage.uflag = calloc_tracked(1, sizeof(GridInt), "io");
+    }
+#endif
+    firstc = 0;
+  }
+  struct RestartStage *r = &stage;
+  io_wait_for(&r->busy);
+  restart_wall = MY_MAX(restart_wall, r->wall);
+
+  // Keep track of our own index
+  restart_id++;
+
+  // read restart file
+  r->type = type;
+  if (type == IO_REGULAR) {
+    sprintf(r->fname, "restarts/restart_%08d.h5", restart_id);
+  } else if (type == IO_ABORT) {
+    sprintf(r->fname, "restarts/restart_abort.h5");
+  }
+
+  // Snapshot
+  r->t = t;
+  r->dt = dt;
+  r->tdump = tdump;
+  r->tlog = tlog;
+  r->nstep = nstep;
+  r->restart_id = restart_id;
+  r->dump_cnt = dump_cnt;
+  if (io_async()) {
+    memcpy(r->P, S->P, sizeof(GridPrim));
+#if KEEP_CONSERVED
+    memcpy(r->U, S->U, sizeof(GridPrim));
+    memcpy(r->uflag, uflag, sizeof(GridInt));
+#endif
+  } else {
+    r->P = &S->P;
+    r->U = &S->U;
+    r->uflag = &uflag;
+  }
+  r->checksum = prims_checksum(r->P);
+
+  io_submit(restart_write_stage, r, &r->busy);
+  if (!io_async()) restart_wall = MY_MAX(restart_wall, r->wall);
+
+  // Aborting runs exit straight after
+  if (type == IO_ABORT) dump_wait();
+
   //count time
   timer_stop(TIMER_RESTART);
 }
 
+// Longest a restart has taken to write, as a guide to how long the next will.
+// Includes only restarts which have finished
+double restart_cost()
+{
+  return restart_wall;
+}
+
 //******************************************************************************
 
-//read restart files
-void restart_read(char *fname, struct FluidState *S)
+#if RESTART_REGRID
+// Old zones overlapping a new one along a direction: index, fraction of the
+// new zone covered, and mean offset over the overlap in units of the old dx
+struct Overlap {
+  int o;
+  double w, m;
+};
+
+// Overlaps of this process's new zones with the old zones lo..hi along one
+// direction, ov[n*max + l] for l < nov[n].  Old edge zones extend beyond the
+// old domain, at their edge values
+static struct Overlap *overlaps(int d, double sxo, double dxo, int no, int lo, int *nov, int *max)
+{
+  int nloc[3] = {N1, N2, N3};
+  double sxn = startx[d+1], dxn = dx[d+1];
+  *max = (int) ceil(dxn/dxo) + 2;
+  struct Overlap *ov = calloc(nloc[d]*(*max), sizeof(struct Overlap));
+
+  for (int n = 0; n < nloc[d]; n++) {
+    double x0 = sxn + (global_start[d] + n)*dxn, x1 = x0 + dxn;
+    int o0 = MY_MAX((int) floor((x0 - sxo)/dxo), 0);
+    int o1 = MY_MIN((int) floor((x1 - sxo)/dxo), no - 1);
+    o0 = MY_MIN(o0, no - 1);
+    o1 = MY_MAX(o1, 0);
+    nov[n] = 0;
+    for (int o = o0; o <= o1; o++) {
+      double xo0 = (o == 0) ? x0 : sxo + o*dxo;
+      double xo1 = (o == no - 1) ? x1 : sxo + (o + 1)*dxo;
+      double a = MY_MAX(x0, xo0), b = MY_MIN(x1, xo1);
+      if (b <= a) continue;
+      double m = (0.5*(a + b) - (sxo + (o + 0.5)*dxo))/dxo;
+      ov[n*(*max) + nov[n]++] = (struct Overlap) {o - lo, (b - a)/dxn, MY_MAX(-0.5, MY_MIN(0.5, m))};
+    }
+  }
+  return ov;
+}
+
+static inline double minmod(double a, double b)
+{
+  return (a*b > 0.) ? ((fabs(a) < fabs(b)) ? a : b) : 0.;
+}
+
+// Centered difference of corner values across zone i,j,k in direction d
+// (1-3), averaged over the zone's four edges in that direction
+static inline double corner_diff(int nj, int ni, double (*A)[nj][ni], int d, int i, int j, int k)
+{
+  int di = (d == 1), dj = (d == 2), dk = (d == 3);
+  double sum = 0.;
+  for (int a = 0; a < 2; a++) {
+    for (int b = 0; b < 2; b++) {
+      // The two directions across d
+      int oi = (d == 1) ? 0 : a, oj = (d == 2) ? 0 : ((d == 1) ? a : b), ok = (d == 3) ? 0 : b;
+      sum += A[k+ok+dk][j+oj+dj][i+oi+di] - A[k+ok][j+oj][i+oi];
+    }
+  }
+  return 0.25*sum;
+}
+
+// Passes correcting the old field's vector potential, each of which cuts the
+// error in its curl several-fold
+#define REGRID_PASSES 20
+
+// Add to A_2, A_3 a potential for the densitized field gB, in the gauge A_1 = 0
+// with A_2 = 0 on the inner face: A_3 runs up the inner face from gB^1, then
+// A_2 and A_3 out along x1 from gB^3 and -gB^2, each edge taking the flux of
+// the zones beside it.  The flux-CT curl of this is gB smoothed over
+// neighboring zones.  x3 is periodic
+static void regrid_march(int no[3], double dxo[3], int ni, int nj, double (*gB)[no[2]][nj-1][ni-1],
+                         double (*A2)[nj][ni], double (*A3)[nj][ni])
+{
+  int n3 = no[2];
+#pragma omp parallel for
+  for (int K = 0; K <= n3; K++) {
+    int k0 = (K + n3 - 1) % n3, k1 = K % n3;
+    double a3 = 0.;
+    for (int J = 0; J < nj; J++) {
+      int j0 = MY_MAX(J - 1, 0), j1 = MY_MIN(J, nj - 2);
+      if (J > 0) a3 += dxo[1]*0.5*(gB[0][k0][J-1][0] + gB[0][k1][J-1][0]);
+      A3[K][J][0] += a3;
+      double b2 = 0., b3 = 0.;
+      for (int I = 0; I < ni - 1; I++) {
+        b2 += 0.25*(gB[1][k0][j0][I] + gB[1][k0][j1][I] + gB[1][k1][j0][I] + gB[1][k1][j1][I]);
+        b3 += 0.25*(gB[2][k0][j0][I] + gB[2][k0][j1][I] + gB[2][k1][j0][I] + gB[2][k1][j1][I]);
+        A2[K][J][I+1] += dxo[0]*b3;
+        A3[K][J][I+1] += a3 - dxo[0]*b2;
+      }
+    }
+  }
+}
+
+// Corner vector potential of the old field, whose flux-CT curl is the old
+// field to within a small fraction: the smoothed potential from regrid_march(),
+// corrected by passes over what its curl still misses.  Fills corners
+// [0, ni) x [0, no2] x [0, no3], reading old zones [0, ni-1) in x1 and every
+// zone in x2 and x3, so that every process finds the same potential
+static void regrid_potential(int no[3], double sxo[3], double dxo[3], int ni,
+                             double (*A2)[no[1]+1][ni], double (*A3)[no[1]+1][ni])
+{
+  int nj = no[1] + 1, n3 = no[2];
+  int ci = ni - 1, cj = no[1];
+  double (*gB)[n3][cj][ci] = malloc(3*sizeof(*gB));
+  double (*res)[n3][cj][ci] = malloc(3*sizeof(*res));
+  hsize_t fdims_o[] = {NVAR, no[2], no[1], no[0]};
+  hsize_t fstart_o[] = {B1, 0, 0, 0};
+  hsize_t fcount_o[] = {3, n3, cj, ci};
+  hsize_t mstart_o[] = {0, 0, 0, 0};
+  hdf5_read_array(gB, "p", 4, fdims_o, fstart_o, fcount_o, fcount_o, mstart_o, H5T_IEEE_F64LE);
+
+  for (int jj = 0; jj < cj; jj++) {
+    for (int ii = 0; ii < ci; ii++) {
+      double X[NDIM] = {0., sxo[0] + (ii + 0.5)*dxo[0], sxo[1] + (jj + 0.5)*dxo[1], 0.};
+      double gcov[NDIM][NDIM], gcon[NDIM][NDIM];
+      gcov_func(X, gcov);
+      double gdet = gcon_func(gcov, gcon);
+      for (int d = 0; d < 3; d++) for (int kk = 0; kk < n3; kk++) gB[d][kk][jj][ii] *= gdet;
+    }
+  }
+  memcpy(res, gB, 3*sizeof(*gB));
+  memset(A2, 0, (n3 + 1)*sizeof(*A2));
+  memset(A3, 0, (n3 + 1)*sizeof(*A3));
+
+  for (int pass = 0; pass < REGRID_PASSES; pass++) {
+    regrid_march(no, dxo, ni, nj, res, A2, A3);
+    if (pass == REGRID_PASSES - 1) break;
+
+    // What the curl of A still misses
+#pragma omp parallel for collapse(2)
+    for (int kk = 0; kk < n3; kk++) {
+      for (int jj = 0; jj < cj; jj++) {
+        for (int ii = 0; ii < ci; ii++) {
+          res[0][kk][jj][ii] = gB[0][kk][jj][ii] - (corner_diff(nj, ni, A3, 2, ii, jj, kk)/dxo[1] -
+                                                    corner_diff(nj, ni, A2, 3, ii, jj, kk)/dxo[2]);
+          res[1][kk][jj][ii] = gB[1][kk][jj][ii] + corner_diff(nj, ni, A3, 1, ii, jj, kk)/dxo[0];
+          res[2][kk][jj][ii] = gB[2][kk][jj][ii] - corner_diff(nj, ni, A2, 1, ii, jj, kk)/dxo[0];
+        }
+      }
+    }
+  }
+
+  free(gB);
+  free(res);
+}
+
+// Transfer prims from a restart on another grid in the same coordinates: each
+// new zone takes the integral over its volume of a limited-linear fit to the
+// old zones.  Densities go as gdet*rho, gdet*u, keeping their totals.  B is the
+// flux-CT curl of the old field's vector potential, interpolated to the new
+// corners, so the new field's corner divergence is zero to roundoff.
+// Returns the checksum of the old zones which this process owns
+static uint64_t restart_regrid(struct FluidState *S, int no[3], double sxo[3], double dxo[3])
+{
+  int ntot[3] = {N1TOT, N2TOT, N3TOT}, nloc[3] = {N1, N2, N3};
+  int lo[3], c[3];
+  for (int d = 0; d < 3; d++) {
+    double sxn = startx[d+1], dxn = dx[d+1];
+    int gs = global_start[d];
+    lo[d] = (int) floor((sxn + gs*dxn - sxo[d])/dxo[d]) - 1;
+    int hi = (int) floor((sxn + (gs + nloc[d])*dxn - sxo[d])/dxo[d]) + 1;
+    if (gs == 0) lo[d] = 0;
+    if (gs + nloc[d] == ntot[d]) hi = no[d] - 1;
+    lo[d] = MY_MIN(MY_MAX(lo[d], 0), no[d] - 1);
+    hi = MY_MIN(MY_MAX(hi, lo[d]), no[d] - 1);
+    c[d] = hi - lo[d] + 1;
+  }
+
+  // Read the old zones we need, plus one either side for slopes
+  double (*Po)[c[2]][c[1]][c[0]] = malloc(NVAR*sizeof(*Po));
+  hsize_t fdims_o[] = {NVAR, no[2], no[1], no[0]};
+  hsize_t fstart_o[] = {0, lo[2], lo[1], lo[0]};
+  hsize_t fcount_o[] = {NVAR, c[2], c[1], c[0]};
+  hsize_t mstart_o[] = {0, 0, 0, 0};
+  hdf5_read_array(Po, "p", 4, fdims_o, fstart_o, fcount_o, fcount_o, mstart_o, H5T_IEEE_F64LE);
+
+  // Checksum the old zones whose centers fall in our new zones, so each is
+  // counted once
+  uint64_t sum = 0;
+  for (int kk = 0; kk < c[2]; kk++) for (int jj = 0; jj < c[1]; jj++) for (int ii = 0; ii < c[0]; ii++) {
+    int idx[3] = {ii, jj, kk}, mine = 1;
+    for (int d = 0; d < 3; d++) {
+      int gn = (int) floor((sxo[d] + (lo[d] + idx[d] + 0.5)*dxo[d] - startx[d+1])/dx[d+1]);
+      gn = MY_MIN(MY_MAX(gn, 0), ntot[d] - 1);
+      mine = mine && gn >= global_start[d] && gn < global_start[d] + nloc[d];
+    }
+    if (!mine) continue;
+    uint64_t zone = ((uint64_t) (lo[2] + kk)*no[1] + (lo[1] + jj))*no[0] + (lo[0] + ii);
+    PLOOP sum += zone_hash(zone, ip, Po[ip][kk][jj][ii]);
+  }
+
+  // Densitize
+  int dens[NVAR] = {0};
+  dens[RHO] = dens[UU] = 1;
+  for (int jj = 0; jj < c[1]; jj++) {
+    for (int ii = 0; ii < c[0]; ii++) {
+      double X[NDIM] = {0., sxo[0] + (lo[0] + ii + 0.5)*dxo[0], sxo[1] + (lo[1] + jj + 0.5)*dxo[1], 0.};
+      double gcov[NDIM][NDIM], gcon[NDIM][NDIM];
+      gcov_func(X, gcov);
+      double gdet = gcon_func(gcov, gcon);
+      for (int kk = 0; kk < c[2]; kk++) PLOOP if (dens[ip]) Po[ip][kk][jj][ii] *= gdet;
+    }
+  }
+
+  int nov[3][MY_MAX(N1, MY_MAX(N2, N3))], max[3];
+  struct Overlap *ov[3];
+  for (int d = 0; d < 3; d++) ov[d] = overlaps(d, sxo[d], dxo[d], no[d], lo[d], nov[d], &max[d]);
+
+  // Old corner each of our new corners sits above, and how far in, linear
+  // beyond the ends of the old grid
+  int nc = MY_MAX(N1, MY_MAX(N2, N3)) + 1, oc[3][nc], nco[3];
+  double f[3][nc];
+  for (int d = 0; d < 3; d++) {
+    nco[d] = 0;
+    for (int n = 0; n <= nloc[d]; n++) {
+      double x = (startx[d+1] + (global_start[d] + n)*dx[d+1] - sxo[d])/dxo[d];
+      oc[d][n] = MY_MIN(MY_MAX((int) floor(x), 0), no[d] - 1);
+      f[d][n] = x - oc[d][n];
+      nco[d] = MY_MAX(nco[d], oc[d][n] + 2);
+    }
+  }
+
+  // Vector potential at the old corners, then at ours
+  double (*A2o)[no[1]+1][nco[0]] = malloc((no[2] + 1)*sizeof(*A2o));
+  double (*A3o)[no[1]+1][nco[0]] = malloc((no[2] + 1)*sizeof(*A3o));
+  regrid_potential(no, sxo, dxo, nco[0], A2o, A3o);
+
+  double (*A2)[N2+1][N1+1] = malloc((N3 + 1)*sizeof(*A2));
+  double (*A3)[N2+1][N1+1] = malloc((N3 + 1)*sizeof(*A3));
+#pragma omp parallel for collapse(3)
+  for (int kc = 0; kc <= N3; kc++) {
+    for (int jc = 0; jc <= N2; jc++) {
+      for (int ic = 0; ic <= N1; ic++) {
+        int I = oc[0][ic], J = oc[1][jc], K = oc[2][kc];
+        double a2 = 0., a3 = 0.;
+        for (int c = 0; c < 2; c++) {
+          for (int b = 0; b < 2; b++) {
+            for (int a = 0; a < 2; a++) {
+              double w = (a ? f[0][ic] : 1. - f[0][ic])*(b ? f[1][jc] : 1. - f[1][jc])*
+                         (c ? f[2][kc] : 1. - f[2][kc]);
+              a2 += w*A2o[K+c][J+b][I+a];
+              a3 += w*A3o[K+c][J+b][I+a];
+            }
+          }
+        }
+        A2[kc][jc][ic] = a2;
+        A3[kc][jc][ic] = a3;
+      }
+    }
+  }
+  free(A2o);
+  free(A3o);
+
+#pragma omp parallel for collapse(2)
+  JLOOP {
+    ILOOP {
+      double X[NDIM], gcov[NDIM][NDIM], gcon[NDIM][NDIM];
+      coord(i, j, 0, CENT, X);
+      gcov_func(X, gcov);
+      double gdet = gcon_func(gcov, gcon);
+
+      KLOOP {
+        double p[NVAR] = {0};
+        for (int l3 = 0; l3 < nov[2][k-NG]; l3++) {
+          struct Overlap v3 = ov[2][(k-NG)*max[2] + l3];
+          for (int l2 = 0; l2 < nov[1][j-NG]; l2++) {
+            struct Overlap v2 = ov[1][(j-NG)*max[1] + l2];
+            for (int l1 = 0; l1 < nov[0][i-NG]; l1++) {
+              struct Overlap v1 = ov[0][(i-NG)*max[0] + l1];
+              double w = v1.w*v2.w*v3.w;
+              int a = v1.o, b = v2.o, e = v3.o;
+              PLOOP {
+                double val = Po[ip][e][b][a];
+                // Limited slopes, flat at the ends of what we read
+                if (a > 0 && a < c[0] - 1)
+                  val += v1.m*minmod(Po[ip][e][b][a+1] - Po[ip][e][b][a], Po[ip][e][b][a] - Po[ip][e][b][a-1]);
+                if (b > 0 && b < c[1] - 1)
+                  val += v2.m*minmod(Po[ip][e][b+1][a] - Po[ip][e][b][a], Po[ip][e][b][a] - Po[ip][e][b-1][a]);
+                if (e > 0 && e < c[2] - 1)
+                  val += v3.m*minmod(Po[ip][e+1][b][a] - Po[ip][e][b][a], Po[ip][e][b][a] - Po[ip][e-1][b][a]);
+                p[ip] += w*val;
+              }
+            }
+          }
+        }
+        PLOOP S->P[ip][k][j][i] = dens[ip] ? p[ip]/gdet : p[ip];
+
+        // B = curl A, with A_1 = 0
+        int ic = i - NG, jc = j - NG, kc = k - NG;
+        S->P[B1][k][j][i] = (corner_diff(N2+1, N1+1, A3, 2, ic, jc, kc)/dx[2] -
+                             corner_diff(N2+1, N1+1, A2, 3, ic, jc, kc)/dx[3])/gdet;
+        S->P[B2][k][j][i] = -corner_diff(N2+1, N1+1, A3, 1, ic, jc, kc)/(dx[1]*gdet);
+        S->P[B3][k][j][i] = corner_diff(N2+1, N1+1, A2, 1, ic, jc, kc)/(dx[1]*gdet);
+      }
+    }
+  }
+
+  for (int d = 0; d < 3; d++) free(ov[d]);
+  free(Po);
+  free(A2);
+  free(A3);
+
+  return sum;
+}
+#endif
+
+//******************************************************************************
+
+//read restart files.  Returns 0 if the prims do not match the file's checksum
+int restart_read(char *fname, struct FluidState *S)
 {
   //open hdft files
   hdf5_open(fname);
@@ -184,11 +673,51 @@ void restart_read(char *fname, struct FluidState *S)
   hdf5_read_single_val(&n1, "n1", H5T_STD_I32LE);
   hdf5_read_single_val(&n2, "n2", H5T_STD_I32LE);
   hdf5_read_single_val(&n3, "n3", H5T_STD_I32LE);
-  if(n1 != N1TOT || n2 != N2TOT || n3 != N3TOT) {
-    if (mpi_io_proc()) fprintf(stderr, "Restart file is wrong size!\n");
+  int regrid = (n1 != N1TOT || n2 != N2TOT || n3 != N3TOT);
+  regridded = regrid;
+  if (regrid && !RESTART_REGRID) {
+    if (mpi_io_proc()) fprintf(stderr, "Restart file is wrong size! File is %dx%dx%d, code is compiled for %dx%dx%d\n"
+                                       "Build with RESTART_REGRID=1 to move it onto this grid\n",
+                                n1, n2, n3, N1TOT, N2TOT, N3TOT);
     exit(-1);
   }
 
+  // Check the physics flags match what we're compiled with.
+  // Older files lack these, so only check what's there
+  if (hdf5_exists("n_prim")) {
+    int n_prim, has_electrons, allmodels, has_positrons, metric, derefine_poles_file;
+    hdf5_read_single_val(&n_prim, "n_prim", H5T_STD_I32LE);
+    hdf5_read_single_val(&has_electrons, "has_electrons", H5T_STD_I32LE);
+    hdf5_read_single_val(&allmodels, "allmodels", H5T_STD_I32LE);
+    hdf5_read_single_val(&has_positrons, "has_positrons", H5T_STD_I32LE);
+    hdf5_read_single_val(&metric, "metric", H5T_STD_I32LE);
+    hdf5_read_single_val(&derefine_poles_file, "derefine_poles", H5T_STD_I32LE);
+    if (n_prim != NVAR || has_electrons != ELECTRONS || allmodels != ALLMODELS ||
+        has_positrons != POSITRONS || metric != METRIC || derefine_poles_file != derefine_poles) {
+      if (mpi_io_proc()) {
+        fprintf(stderr, "Restart file was written with different physics!\n");
+        fprintf(stderr, "File: NVAR %d ELECTRONS %d ALLMODELS %d POSITRONS %d METRIC %d DEREFINE_POLES %d\n",
+                n_prim, has_electrons, allmodels, has_positrons, metric, derefine_poles_file);
+        fprintf(stderr, "Code: NVAR %d ELECTRONS %d ALLMODELS %d POSITRONS %d METRIC %d DEREFINE_POLES %d\n",
+                NVAR, ELECTRONS, ALLMODELS, POSITRONS, METRIC, derefine_poles);
+      }
+      exit(-1);
+    }
+  }
+
+  // Note when we're picking up a run on a different layout
+  if (hdf5_exists("n1cpu")) {
+    int n1cpu, n2cpu, n3cpu, nthreads_file;
+    hdf5_read_single_val(&n1cpu, "n1cpu", H5T_STD_I32LE);
+    hdf5_read_single_val(&n2cpu, "n2cpu", H5T_STD_I32LE);
+    hdf5_read_single_val(&n3cpu, "n3cpu", H5T_STD_I32LE);
+    hdf5_read_single_val(&nthreads_file, "nthreads", H5T_STD_I32LE);
+    if (mpi_io_proc() && (n1cpu != N1CPU || n2cpu != N2CPU || n3cpu != N3CPU || nthreads_file != nthreads)) {
+      fprintf(stderr, "Restart written with %dx%dx%d ranks, %d threads; reading with %dx%dx%d ranks, %d threads\n\n",
+              n1cpu, n2cpu, n3cpu, nthreads_file, N1CPU, N2CPU, N3CPU, nthreads);
+    }
+  }
+
   //read time, number of step, gas constant
   hdf5_read_single_val(&t, "t", H5T_IEEE_F64LE);
   hdf5_read_single_val(&nstep, "nstep", H5T_STD_I32LE);
@@ -243,14 +772,61 @@ if (METRIC != MKS) {
 /////////////////////////////////////////////////////////////
 
   // Read data
-  hsize_t fstart[] = {0, global_start[2], global_start[1], global_start[0]};
-  hdf5_read_array(S->P, "p", 4, fdims, fstart, fcount, mdims, mstart, H5T_IEEE_F64LE);
+  uint64_t sum = 0;
+  if (!regrid) {
+    // Each rank takes its own hyperslab of the global array, whatever the writer's layout
+    hsize_t fstart[] = {0, global_start[2], global_start[1], global_start[0]};
+    hdf5_read_array(S->P, "p", 4, fdims, fstart, fcount, mdims, mstart, H5T_IEEE_F64LE);
+
+#if KEEP_CONSERVED
+    // Otherwise U is rebuilt from the prims, and the run only matches to
+    // within the U_to_P tolerance
+    kept_u = hdf5_exists("u") && hdf5_exists("uflag");
+    if (kept_u) {
+      hdf5_read_array(S->U, "u", 4, fdims, fstart, fcount, mdims, mstart, H5T_IEEE_F64LE);
+      hdf5_read_array(uflag, "uflag", 3, fdims + 1, fstart + 1, fcount + 1, mdims + 1, mstart + 1,
+                      H5T_STD_I32LE);
+    }
+#endif
+  }
+#if RESTART_REGRID
+  else {
+    // Old grid, from the file's domain
+    int no[3] = {n1, n2, n3};
+    double sxo[3], dxo[3];
+#if METRIC == MKS
+    sxo[0] = log(Rin); sxo[1] = 0.; sxo[2] = 0.;
+    dxo[0] = log(Rout/Rin)/n1; dxo[1] = 1./n2; dxo[2] = 2.*M_PI/n3;
+#else
+    sxo[0] = x1Min; sxo[1] = x2Min; sxo[2] = x3Min;
+    dxo[0] = (x1Max - x1Min)/n1; dxo[1] = (x2Max - x2Min)/n2; dxo[2] = (x3Max - x3Min)/n3;
+#endif
+    // New grid
+    set_points();
+    if (mpi_io_proc()) fprintf(stderr, "Regridding from %dx%dx%d to %dx%dx%d\n\n", n1, n2, n3, N1TOT, N2TOT, N3TOT);
+
+    sum = restart_regrid(S, no, sxo, dxo);
+
+    // Keep to the Courant condition on a finer grid
+    double refine = 1.;
+    for (int d = 0; d < 3; d++) refine = MY_MIN(refine, dx[d+1]/dxo[d]);
+    dt *= refine;
+  }
+#endif
+
+  // Older files have no checksum, and are trusted
+  int has_checksum = hdf5_exists("checksum");
+  uint64_t checksum = 0;
+  if (has_checksum) hdf5_read_single_val(&checksum, "checksum", H5T_STD_U64LE);
 
   //close hdf5 file
   hdf5_close();
 
   //mpi stuff
   mpi_barrier();
+
+  if (regrid) return !has_checksum || mpi_reduce_uint64(sum) == checksum;
+  return !has_checksum || prims_checksum(&S->P) == checksum;
 }
 
 //******************************************************************************
@@ -258,38 +834,100 @@ if (METRIC != MKS) {
 // initialize stuff after restart
 int restart_init(struct GridGeom *G, struct FluidState *S)
 {
-  // print out restart file
-  char fname[STRLEN];
-  sprintf(fname, "restarts/restart.last");
+  // Candidates in order: restart.last (index -1), then every other restart on
+  // disk, newest first.  Listed by the io proc, so all processes agree
+  int *ids, n = 0, last = -2;
+  if (mpi_io_proc()) {
+    n = restart_list(&ids);
+    if (access("restarts/restart.last", F_OK) != -1) {
+      char target[STRLEN];
+      ssize_t len = readlink("restarts/restart.last", target, STRLEN - 1);
+      if (len > 0) {
+        target[len] = '\0';
+        if (sscanf(target, "restart_%8d.h5", &last) != 1) last = -2;
+      }
+      // Put it first, and don't try it twice
+      ids = realloc(ids, (n + 1)*sizeof(int));
+      int m = n;
+      for (int l = 0; l < n; l++) if (ids[l] == last) m = l;
+      memmove(ids + 1, ids, m*sizeof(int));
+      ids[0] = -1;
+      if (m == n) n++;
+    }
+  } else {
+    ids = NULL;
+  }
+  mpi_int_broadcast(&n);
+  if (!mpi_io_proc()) ids = malloc(MY_MAX(n, 1)*sizeof(int));
+  for (int m = 0; m < n; m++) mpi_int_broadcast(&ids[m]);
 
-  FILE *fp = fopen(fname,"rb");
-  if (fp == NULL) {
+  if (n == 0) {
     if (mpi_io_proc())
-      fprintf(stdout, "No restart file: error %d\n\n", errno);
+      fprintf(stdout, "No restart file\n\n");
+    free(ids);
     return 0;
   }
-  fclose(fp);
 
-  //mpi stuff
-  if (mpi_io_proc())
-    fprintf(stdout, "Loading restart file %s\n\n", fname);
+  // Take the first which opens and matches its checksum
+  char fname[STRLEN];
+  int found = 0;
+  for (int m = 0; m < n && !found; m++) {
+    if (ids[m] < 0) {
+      sprintf(fname, "restarts/restart.last");
+    } else {
+      sprintf(fname, "restarts/restart_%08d.h5", ids[m]);
+    }
+
+    int readable = mpi_io_proc() ? hdf5_can_open(fname) : 0;
+    mpi_int_broadcast(&readable);
+    if (!readable) {
+      if (mpi_io_proc()) fprintf(stderr, "Could not open restart file %s, trying an older one\n", fname);
+      continue;
+    }
 
-  //zero all arrays
-  zero_arrays();
+    //mpi stuff
+    if (mpi_io_proc())
+      fprintf(stdout, "Loading restart file %s\n\n", fname);
+
+    //zero all arrays
+    zero_arrays();
 
-  //read files
-  restart_read(fname, S);
+    //read files
+    found = restart_read(fname, S);
+    if (!found && mpi_io_proc())
+      fprintf(stderr, "Restart file %s fails its checksum, trying an older one\n", fname);
+  }
+  free(ids);
+
+  // Never silently start over on top of an existing run
+  if (!found) {
+    if (mpi_io_proc())
+      fprintf(stderr, "No usable restart file in restarts/!  Remove them to start a new run\n");
+    exit(-1);
+  }
 
   //initialize grids
   set_grid(G);
 
   // Calculate ucon, ucov, bcon, bcov, and conservative variables 
   get_state_vec(G, S, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
-  prim_to_flux_vec(G, S, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, S->U);
+  if (!kept_u) prim_to_flux_vec(G, S, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, S->U);
 
   //boundary conditions
   set_bounds(G, S);
 
+  // The regridded field should keep the divergence constraint
+  if (regridded) {
+    double divbmax = 0.;
+#pragma omp parallel for collapse(3) reduction(max:divbmax)
+    ZLOOP {
+      double divb = flux_ct_divb(G, S, i, j, k);
+      if (divb > divbmax) divbmax = divb;
+    }
+    divbmax = mpi_max(divbmax);
+    if (mpi_io_proc()) fprintf(stdout, "Regridded divbmax: %g\n\n", divbmax);
+  }
+
   return 1;
 }
 
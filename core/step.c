@@ -19,6 +19,7 @@
 
 // delcare fuctions
 double advance_fluid(struct GridGeom *G, struct FluidState *Si, struct FluidState *Ss, struct FluidState *Sf, double Dt);
+static void update_conserved(struct GridGeom *G, struct FluidState *S);
 
 //**************************************************************************************************************************
 
@@ -32,23 +33,28 @@ void step(struct GridGeom *G, struct FluidState *S)
   //declare arrays
   static int first_call = 1;
   if (first_call) {
-    Stmp = calloc(1,sizeof(struct FluidState));
-    Ssave = calloc(1,sizeof(struct FluidState));
+    // The half step never needs the current, nor the saved prims U
+    Stmp = alloc_state(STATE_CONS, "step");
+    Ssave = alloc_state(STATE_PRIM, "step");
     first_call = 0;
   }
 
+  // The current is only calculated for full dumps, evaluated as at the end
+  int calc_current = (t + dt >= tdump && t + dt >= tfull);
+
   // backup primitive variables 
   ////////////////////////////////////////////////////////////////////
-  // Need both P_n and P_n+1 to calculate current
+  // Need both P_n and P_n+1 to calculate current, so only then
   // Work around ICC 18.0.2 bug in assigning to pointers to structs
-  // TODO use pointer tricks to avoid deep copy on both compilers
   ////////////////////////////////////////////////////////////////////
+  if (calc_current) {
 #if INTEL_WORKAROUND
-  memcpy(&(Ssave->P),&(S->P),sizeof(GridPrim));
+    memcpy(&(Ssave->P),&(S->P),sizeof(GridPrim));
 #else
 #pragma omp parallel for simd collapse(4)
-  PLOOP ZLOOPALL Ssave->P[ip][k][j][i] = S->P[ip][k][j][i];
+    PLOOP ZLOOPALL Ssave->P[ip][k][j][i] = S->P[ip][k][j][i];
 #endif
+  }
 
   //print out
   LOGN("Step %d",nstep);
@@ -57,6 +63,9 @@ void step(struct GridGeom *G, struct FluidState *S)
   // TODO add back well-named flags /after/ events
   ///////////////////////////////////////////////////
 
+  // Conservative variables for the step, which both stages start from
+  update_conserved(G, S);
+
   /*-------------------------------------------------------------------------*/
   // Predictor setup, here, Stmp is empty, but then when passed to
   // advanced_fluid, it will get compies from S, Stmp then becomes the 
@@ -81,7 +90,9 @@ void step(struct GridGeom *G, struct FluidState *S)
   timer_stop(TIMER_POSITRON);
 #endif
 
-  // Set floor values to primitive variables 
+  // Set floor values to primitive variables.  The status counters
+  // (nfloor_hit, nfail_utop) count zones once per step, in the corrector
+  long int nfloor_save = nfloor_hit, nfail_save = nfail_utop;
   fixup(G, Stmp);
   FLAG("Fixup Tmp");
 #if ELECTRONS
@@ -92,16 +103,22 @@ void step(struct GridGeom *G, struct FluidState *S)
   // set boundary conditions 
   ////////////////////////////////////////////////////////////////////
   // Need an MPI call _before_ fixup_utop to obtain correct pflags
+  // It interpolates only RHO..U3 from the nearest neighbors, so
+  // that's all we exchange here
   ////////////////////////////////////////////////////////////////////
-  set_bounds(G, Stmp);
+  set_bounds_halo(G, Stmp, B1, 1, 1);
   FLAG("First bounds Tmp");
 
   //replace bad points (failed convergence) with trilinear interpolations 
   fixup_utoprim(G, Stmp);
   FLAG("Fixup U_to_P Tmp");
+  nfloor_hit = nfloor_save;
+  nfail_utop = nfail_save;
 
   //after that, set boundary conditions again
-  set_bounds(G, Stmp);
+  //all variables, as deep as the reconstruction reads. pflag is clear now
+  //this exchange can complete behind the interior work of the corrector
+  set_bounds_start(G, Stmp, NVAR, NG_RECON, 0);
   FLAG("Second bounds Tmp");
   
   /*-------------------------------------------------------------------------*/
@@ -111,6 +128,14 @@ void step(struct GridGeom *G, struct FluidState *S)
   double ndt = advance_fluid(G, S, Stmp, S, dt);
   FLAG("Advance Fluid Full");
 
+  // start the timestep reduction now, so that it completes behind the
+  // fixups and boundary exchanges below rather than stalling the step
+#if STATIC_TIMESTEP
+  if(DEBUG) mpi_min_start(ndt);
+#else
+  mpi_min_start(ndt);
+#endif
+
   // find electronic source terms
 #if ELECTRONS
   heat_electrons(G, Stmp, S);
@@ -135,15 +160,23 @@ void step(struct GridGeom *G, struct FluidState *S)
 #endif
 
   // set boundary conditions 
-  set_bounds(G, S);
+  set_bounds_halo(G, S, B1, 1, 1);
   FLAG("First bounds Full");
 
   //replace bad points (failed convergence) with trilinear interpolations 
   fixup_utoprim(G, S);
   FLAG("Fixup U_to_P Full");
 
+  // Once per step, so only the corrector's floors and ceilings, including
+  // those reapplied to interpolated zones
+#if ZONE_STATS
+#pragma omp parallel for collapse(3)
+  ZLOOP zone_stats[ZS_FLOOR][k][j][i] += (fflag[k][j][i] != 0);
+#endif
+
   //after that, set boundary conditions again
-  set_bounds(G, S);
+  //as deep as the next step's reconstruction reads, which also covers current_calc
+  set_bounds_halo(G, S, NVAR, NG_RECON, 0);
   FLAG("Second bounds Full");
   
   /*-------------------------------------------------------------------------*/
@@ -151,19 +184,19 @@ void step(struct GridGeom *G, struct FluidState *S)
   // Increment time
   t += dt;
 
-  // If we're dumping this step, calculate the current
-  if (t >= tdump) {
+  // If we're writing a full dump this step, calculate the current
+  if (calc_current) {
     current_calc(G, S, Ssave, dt);
   }
 
   // New dt proxy to choose fluid or light timestep
   double max_dt = 0, fake_dt = 0;
 #if STATIC_TIMESTEP
-  if(DEBUG) fake_dt = mpi_min(ndt);
+  if(DEBUG) fake_dt = mpi_min_wait();
   max_dt = cour*dt_light;
 #else
   if(DEBUG) fake_dt = cour*dt_light;
-  max_dt = mpi_min(ndt);
+  max_dt = mpi_min_wait();
 #endif
 
   // Set next timestep
@@ -191,21 +224,39 @@ inline double advance_fluid(struct GridGeom *G, struct FluidState *Si, struct Fl
   //assign memories
   static int firstc = 1;
   if (firstc) {
-    dU = calloc(1,sizeof(GridPrim));
-    F = calloc(1,sizeof(struct FluidFlux));
+    // Both are rewritten before use on every call
+    dU = scratch_alloc(SCRATCH_ADVANCE, sizeof(GridPrim), "advance");
+    F = scratch_alloc(SCRATCH_ADVANCE, sizeof(struct FluidFlux), "advance");
     firstc = 0;
   }
 
-  // backup primitive variables
+  // backup primitive variables, the starting guess for U_to_P
+  // The corrector updates in place, with nothing to copy
   ////////////////////////////////////////////////////////////////////
   // Work around ICC 18.0.2 bug in assigning to pointers to structs
   ////////////////////////////////////////////////////////////////////
+  if (Sf != Si) {
 #if INTEL_WORKAROUND
-  memcpy(&(Sf->P),&(Si->P),sizeof(GridPrim));
+    memcpy(&(Sf->P),&(Si->P),sizeof(GridPrim));
 #else
 #pragma omp parallel for simd collapse(4)
-  PLOOP ZLOOPALL Sf->P[ip][k][j][i] = Si->P[ip][k][j][i];
+    PLOOP ZLOOPALL Sf->P[ip][k][j][i] = Si->P[ip][k][j][i];
 #endif
+  }
+
+  // Get conservative variables, and fluid source terms
+  // These touch only the interior of Ss, so are done while any
+  // boundary exchange started by the caller is still in flight
+  timer_start(TIMER_UPDATE_U);
+  get_state_vec(G, Ss, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+  get_fluid_source(G, Ss, dU);
+
+  // Conservative variables for the last time step are Si->U, kept
+  // current by update_conserved()
+  timer_stop(TIMER_UPDATE_U);
+
+  // Ghost zones of Ss are needed from here on
+  set_bounds_finish();
 
   //get fluxes
   double ndt = get_flux(G, Ss, F);
@@ -233,35 +284,17 @@ inline double advance_fluid(struct GridGeom *G, struct FluidState *Si, struct Fl
 //  FLAG("CT Step");
 //////////////////////////////////
 
-  // Flux diagnostic globals
-  ///////////////////////////////////////////////////
-  // TODO don't compute every step, only for logs?
-  ///////////////////////////////////////////////////
-  diag_flux(F);
+  // Flux diagnostics, from the corrector (fluxes of the half-step state),
+  // which carries the whole step
+  if (Ss != Si) diag_flux(F, Dt);
 
 //////////////////////////////////
 //  update_f(F, dU);
 //  FLAG("Flux Diags");
-//////////////////////////////////
-
-  // Get conservative variables, and fluid source terms
-  timer_start(TIMER_UPDATE_U);
-  get_state_vec(G, Ss, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
-  get_fluid_source(G, Ss, dU);
-
-  // Find conservative variables for the last time step'
-  /////////////////////////////////////////////
-  // TODO skip this call if Si,Ss are aliased
-  /////////////////////////////////////////////
-  get_state_vec(G, Si, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
-  prim_to_flux_vec(G, Si, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, Si->U);
-
-//////////////////////////////////
-//  update_f(F, dU);
-//  FLAG("Fixed flux. Got Si->U");
 //////////////////////////////////
 
   // update conservative variables 
+  timer_start(TIMER_UPDATE_U);
 #pragma omp parallel for simd collapse(4)
   PLOOP ZLOOP {
     Sf->U[ip][k][j][i] = Si->U[ip][k][j][i] +
@@ -288,14 +321,20 @@ inline double advance_fluid(struct GridGeom *G, struct FluidState *Si, struct Fl
   #endif
 
   //convert from conservative to primitive variables
+  // Iteration counts vary zone to zone, so time each thread's share
   timer_start(TIMER_U_TO_P);
-#pragma omp parallel for collapse(3)
-  ZLOOP {
-    pflag[k][j][i] = U_to_P(G, Sf, i, j, k, CENT);
-    ////////////////////////////////////////////////////////////////////
-    // This is too annoying even for debug
-    //if (pflag[k][j][i] != 0) LOGN("Pflag is %d\n", pflag[k][j][i]);
-    ////////////////////////////////////////////////////////////////////
+#pragma omp parallel
+  {
+    timer_thread_start();
+#pragma omp for collapse(3) nowait
+    ZLOOP {
+      pflag[k][j][i] = U_to_P(G, Sf, i, j, k, CENT);
+      ////////////////////////////////////////////////////////////////////
+      // This is too annoying even for debug
+      //if (pflag[k][j][i] != 0) LOGN("Pflag is %d\n", pflag[k][j][i]);
+      ////////////////////////////////////////////////////////////////////
+    }
+    timer_thread_stop();
   }
   timer_stop(TIMER_U_TO_P);
 
@@ -306,12 +345,46 @@ inline double advance_fluid(struct GridGeom *G, struct FluidState *Si, struct Fl
   //get_state_vec(G, Sf, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
   ////////////////////////////////////////////////////////////////////
 
-  // save error flag in u to p subroutine
+  // save error flag in u to p subroutine, keeping the last failure in each
+  // zone until a full dump writes and clears them.  Failed zones get
+  // interpolated prims, so their U must be recalculated too
 #pragma omp parallel for simd collapse(3)
   ZLOOPALL {
-    fail_save[k][j][i] = pflag[k][j][i];
+    if (pflag[k][j][i]) fail_save[k][j][i] = uflag[k][j][i] = pflag[k][j][i];
+#if ZONE_STATS
+    if (Ss != Si) zone_stats[ZS_UTOP_FAIL][k][j][i] += (pflag[k][j][i] != 0);
+#endif
   }
 
   //output
   return ndt;
 }
+
+//**************************************************************************************************************************
+
+// Bring S->U up to date with S->P at the start of a step.  U is kept from the
+// input to the last step's U_to_P, so only zones whose prims were changed
+// since, by floors, ceilings or a failed inversion, are recalculated: those
+// marked in uflag, which is every zone at the start of a run.  Electron
+// heating changes prims everywhere, so then all zones are
+static void update_conserved(struct GridGeom *G, struct FluidState *S)
+{
+  timer_start(TIMER_UPDATE_U);
+
+  if (ELECTRONS || !KEEP_CONSERVED) {
+    get_state_vec(G, S, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1);
+    prim_to_flux_vec(G, S, 0, CENT, 0, N3 - 1, 0, N2 - 1, 0, N1 - 1, S->U);
+  } else {
+#pragma omp parallel for collapse(3)
+    ZLOOP {
+      if (uflag[k][j][i]) {
+        get_state(G, S, i, j, k, CENT);
+        prim_to_flux(G, S, i, j, k, 0, CENT, S->U);
+      }
+    }
+  }
+#pragma omp parallel for simd collapse(3)
+  ZLOOPALL uflag[k][j][i] = 0;
+
+  timer_stop(TIMER_UPDATE_U);
+}
@@ -0,0 +1,219 @@
+//******************************************************************************
+//*                                                                            *
+//* STREAMS.C                                                                  *
+//*                                                                            *
+//* SUB-VOLUME OUTPUT STREAMS AT THEIR OWN CADENCES                            *
+//*                                                                            *
+//******************************************************************************
+
+// import headers
+#include "decs.h"
+#include "hdf5_utils.h"
+
+#ifdef OUTPUT_STREAMS
+
+struct OutputStream {
+  const char *name;
+  double cadence;
+  int range[3][2];
+  double rmin, rmax;
+  int stride;
+};
+
+static struct OutputStream streams[] = {OUTPUT_STREAMS};
+#define NSTREAMS ((int) (sizeof(streams)/sizeof(streams[0])))
+
+// Per stream: next output time, global zones kept in each direction, and the
+// part of them on this process, in file coordinates
+static double tnext[NSTREAMS];
+static int gstart[NSTREAMS][3], gstop[NSTREAMS][3], fsize[NSTREAMS][3], lstart[NSTREAMS][3], lcount[NSTREAMS][3];
+
+// Each stream's output is staged here, so the I/O thread can write it while
+// the run goes on
+struct StreamStage {
+  float *out;
+  double t, dt;
+  int nstep, cnt, busy;
+  int s;
+};
+static struct StreamStage stage[NSTREAMS];
+
+//******************************************************************************
+
+// Resolve each stream's region against the grid and this process, and
+// allocate its staging buffer
+void stream_init()
+{
+  int ntot[3] = {N1TOT, N2TOT, N3TOT};
+  int nloc[3] = {N1, N2, N3};
+
+  for (int s = 0; s < NSTREAMS; s++) {
+    struct OutputStream *st = &streams[s];
+    int lo[3], hi[3];
+    for (int d = 0; d < 3; d++) {
+      lo[d] = st->range[d][0];
+      hi[d] = (st->range[d][1] > 0) ? st->range[d][1] : ntot[d];
+    }
+
+    // Zones with centers inside [rmin, rmax] replace any X1 index range
+    if (st->rmax > 0.) {
+      lo[0] = N1TOT; hi[0] = 0;
+      for (int gi = 0; gi < N1TOT; gi++) {
+        double X[NDIM] = {0., startx[1] + (gi + 0.5)*dx[1], startx[2] + 0.5*N2TOT*dx[2], 0.};
+        double r = X[1];
+#if METRIC == MKS
+        double th;
+        bl_coord(X, &r, &th);
+#endif
+        if (r >= st->rmin && r <= st->rmax) {
+          lo[0] = MY_MIN(lo[0], gi);
+          hi[0] = MY_MAX(hi[0], gi + 1);
+        }
+      }
+    }
+
+    int stride = MY_MAX(st->stride, 1);
+    for (int d = 0; d < 3; d++) {
+      if (lo[d] < 0 || hi[d] > ntot[d] || lo[d] >= hi[d]) {
+        if (mpi_io_proc())
+          fprintf(stderr, "Output stream %s has an empty or out-of-bounds region!\n", st->name);
+        exit(-1);
+      }
+      // Blocks owned by one process reach into its halo, as deep as it is
+      // kept after a step
+      if (nloc[d] < ntot[d] && stride - 1 > NG_RECON) {
+        if (mpi_io_proc())
+          fprintf(stderr, "Output stream %s: stride %d is larger than the halo allows (%d)!\n",
+                  st->name, stride, NG_RECON + 1);
+        exit(-1);
+      }
+      gstart[s][d] = lo[d];
+      gstop[s][d] = hi[d];
+      fsize[s][d] = (hi[d] - lo[d] + stride - 1)/stride;
+
+      // First kept zone at or after our start, and how many we hold
+      int first = MY_MAX(lo[d], global_start[d]);
+      first = lo[d] + stride*((first - lo[d] + stride - 1)/stride);
+      int last = MY_MIN(hi[d], global_start[d] + nloc[d]);
+      lstart[s][d] = (first - lo[d])/stride;
+      lcount[s][d] = (first < last) ? (last - first + stride - 1)/stride : 0;
+    }
+
+    // Keep to multiples of the cadence across restarts
+    tnext[s] = st->cadence*ceil(t/st->cadence);
+
+    stage[s].s = s;
+    stage[s].out = calloc_tracked(MY_MAX(lcount[s][0]*lcount[s][1]*lcount[s][2]*NVAR, 1), sizeof(float),
+                                  "streams");
+  }
+}
+
+//******************************************************************************
+
+// Average the prims over each stride^3 block of kept zones, weighted by
+// volume, into the stage in file order (x1,x2,x3,var) as in dumps.  A block
+// belongs to the process holding its first zone, and is cut off at the edge
+// of the region
+static void stream_stage(struct GridGeom *G, struct FluidState *S, int s, int stride)
+{
+  float *out = stage[s].out;
+  int c1 = lcount[s][0], c2 = lcount[s][1], c3 = lcount[s][2];
+  if (c1*c2*c3 == 0) return;
+
+  // Local index of each direction's first kept zone, and of the region's end
+  int first[3], stop[3];
+  for (int d = 0; d < 3; d++) {
+    first[d] = NG + gstart[s][d] + stride*lstart[s][d] - global_start[d];
+    stop[d] = NG + gstop[s][d] - global_start[d];
+  }
+
+#pragma omp parallel for collapse(3)
+  for (int a = 0; a < c1; a++) {
+    for (int b = 0; b < c2; b++) {
+      for (int c = 0; c < c3; c++) {
+        int i0 = first[0] + stride*a, j0 = first[1] + stride*b, k0 = first[2] + stride*c;
+        double sum[NVAR] = {0}, vol = 0.;
+        for (int k = k0; k < MY_MIN(k0 + stride, stop[2]); k++) {
+          for (int j = j0; j < MY_MIN(j0 + stride, stop[1]); j++) {
+            for (int i = i0; i < MY_MIN(i0 + stride, stop[0]); i++) {
+              double dV = G->gdet[CENT][j][i];
+              PLOOP sum[ip] += S->P[ip][k][j][i]*dV;
+              vol += dV;
+            }
+          }
+        }
+        PLOOP out[((a*c2 + b)*c3 + c)*NVAR + ip] = sum[ip]/vol;
+      }
+    }
+  }
+}
+
+// Write a staged stream.  Called from the I/O thread when writing asynchronously
+static void stream_write(void *arg)
+{
+  struct StreamStage *sg = (struct StreamStage *) arg;
+  int s = sg->s;
+  struct OutputStream *st = &streams[s];
+  int stride = MY_MAX(st->stride, 1);
+
+  // Number the files by time, so they stay consistent across restarts
+  char fname[STRLEN];
+  sprintf(fname, "dumps/%s_%08d.h5", st->name, sg->cnt);
+
+  hdf5_create(fname);
+  hdf5_set_directory("/");
+  hdf5_write_single_val(&sg->t, "t", H5T_IEEE_F64LE);
+  hdf5_add_units("t", "code");
+  hdf5_write_single_val(&sg->dt, "dt", H5T_IEEE_F64LE);
+  hdf5_write_single_val(&sg->nstep, "n_step", H5T_STD_I32LE);
+  hdf5_write_single_val(&st->cadence, "cadence", H5T_IEEE_F64LE);
+
+  // Where the kept zones sit in the full grid: zone n in x1 is the average
+  // over global zones i_start + n*stride up to the next, likewise in x2, x3
+  const char *starts[3] = {"i_start", "j_start", "k_start"};
+  const char *sizes[3] = {"n1", "n2", "n3"};
+  for (int d = 0; d < 3; d++) {
+    hdf5_write_single_val(&gstart[s][d], starts[d], H5T_STD_I32LE);
+    hdf5_write_single_val(&fsize[s][d], sizes[d], H5T_STD_I32LE);
+  }
+  hdf5_write_single_val(&stride, "stride", H5T_STD_I32LE);
+  int n_prim = NVAR;
+  hdf5_write_single_val(&n_prim, "n_prim", H5T_STD_I32LE);
+
+  // Processes outside the region select nothing
+  int c1 = lcount[s][0], c2 = lcount[s][1], c3 = lcount[s][2];
+  hsize_t fdims[] = {fsize[s][0], fsize[s][1], fsize[s][2], NVAR};
+  hsize_t fstart[] = {lstart[s][0], lstart[s][1], lstart[s][2], 0};
+  hsize_t fcount[] = {c1, c2, c3, NVAR};
+  hsize_t mstart[] = {0, 0, 0, 0};
+  hdf5_write_array(sg->out, "prims", 4, fdims, fstart, fcount, fcount, mstart, H5T_IEEE_F32LE);
+  hdf5_add_units("prims", "code");
+
+  hdf5_close();
+}
+
+// Stage and queue any streams which are due
+void stream_output(struct GridGeom *G, struct FluidState *S)
+{
+  for (int s = 0; s < NSTREAMS; s++) {
+    if (t < tnext[s]) continue;
+
+    timer_start(TIMER_IO);
+    struct StreamStage *sg = &stage[s];
+    io_wait_for(&sg->busy);
+
+    sg->t = t;
+    sg->dt = dt;
+    sg->nstep = nstep;
+    sg->cnt = (int) (tnext[s]/streams[s].cadence + 0.5);
+    if(mpi_io_proc()) fprintf(stdout, "STREAM dumps/%s_%08d.h5\n", streams[s].name, sg->cnt);
+
+    stream_stage(G, S, s, MY_MAX(streams[s].stride, 1));
+    io_submit(stream_write, sg, &sg->busy);
+    timer_stop(TIMER_IO);
+
+    while (tnext[s] <= t) tnext[s] += streams[s].cadence;
+  }
+}
+
+#endif // OUTPUT_STREAMS
@@ -10,13 +10,41 @@
 #include "decs.h"
 #include "positrons.h"
 
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+
 //declare variables
+// Timers nest: each is accounted as node (parent, code), under the timer which
+// was running when it started, so the children of a timer show where its time
+// went.  A timer started again while it is already running counts only once
+#define NO_TIMER NUM_TIMERS
+#define NNODE ((NUM_TIMERS + 1)*NUM_TIMERS)
+#define NODE(parent, code) ((parent)*NUM_TIMERS + (code))
 static double timers[NUM_TIMERS];
 static double times[NUM_TIMERS];
+static double node_times[NNODE];
+static int parent[NUM_TIMERS], running[NUM_TIMERS];
+static int stack[NUM_TIMERS + 1], depth = 0;
+
+// The stack belongs to the thread which called time_init.  Helper threads
+// (COMM_THREAD, ASYNC_IO) are also thread 0 of their own OpenMP team, so
+// "omp master" alone doesn't keep them out
+static pthread_t main_thread;
+#define TIMER_THREAD() (pthread_equal(pthread_self(), main_thread))
+
+// Per-thread work inside parallel regions, [NNODE][nthread_slots]
+static double *thread_times, *thread_start;
+static int nthread_slots = 0;
 
 // initialize 
 static int nstep_start = 0;
 
+// State at the last status.json, to report the interval since
+static double status_times[NUM_TIMERS], status_wall, status_t, run_start = -1.;
+static int status_nstep;
+
 //******************************************************************************
 
 //intiailize time
@@ -25,7 +53,29 @@ void time_init()
   for (int n = 0; n < NUM_TIMERS; n++) {
     times[n] = 0.;
   }
+  for (int n = 0; n < NNODE; n++) node_times[n] = 0.;
+
+  if (thread_times == NULL) {
+    nthread_slots = MY_MAX(nthreads, omp_get_max_threads());
+    thread_times = calloc(NNODE*nthread_slots, sizeof(double));
+    thread_start = calloc(nthread_slots, sizeof(double));
+  } else {
+    memset(thread_times, 0, NNODE*nthread_slots*sizeof(double));
+  }
+  stack[0] = NO_TIMER;
+  main_thread = pthread_self();
   nstep_start = nstep;
+
+  for (int n = 0; n < NUM_TIMERS; n++) status_times[n] = 0.;
+  status_wall = omp_get_wtime();
+  if (run_start < 0.) run_start = status_wall;
+  status_t = t;
+  status_nstep = nstep;
+  nfail_utop = nfloor_hit = 0;
+
+#if PERF_COUNTERS
+  counter_init();
+#endif
 }
 
 //******************************************************************************
@@ -33,10 +83,17 @@ void time_init()
 //count the starting time
 inline void timer_start(int timerCode)
 {
-  if (TIMERS || timerCode == TIMER_ALL) {
+  if ((TIMERS || timerCode == TIMER_ALL) && TIMER_THREAD()) {
 #pragma omp master
     {
-      timers[timerCode] = omp_get_wtime();
+      if (running[timerCode]++ == 0) {
+        parent[timerCode] = stack[depth];
+        stack[++depth] = timerCode;
+#if PERF_COUNTERS
+        counter_start(timerCode);
+#endif
+        timers[timerCode] = omp_get_wtime();
+      }
     }
   }
 }
@@ -46,85 +103,406 @@ inline void timer_start(int timerCode)
 //stop the timer
 inline void timer_stop(int timerCode)
 {
-  if (TIMERS || timerCode == TIMER_ALL) {
+  if ((TIMERS || timerCode == TIMER_ALL) && TIMER_THREAD()) {
 #pragma omp master
     {
-      times[timerCode] += (omp_get_wtime() - timers[timerCode]);
+      if (running[timerCode] > 0 && --running[timerCode] == 0) {
+        double elapsed = omp_get_wtime() - timers[timerCode];
+#if PERF_COUNTERS
+        counter_stop(timerCode);
+#endif
+        times[timerCode] += elapsed;
+        node_times[NODE(parent[timerCode], timerCode)] += elapsed;
+
+        // Usually on top, but take it out from wherever it is
+        int n = depth;
+        while (n > 0 && stack[n] != timerCode) n--;
+        for (; n > 0 && n < depth; n++) stack[n] = stack[n+1];
+        if (depth > 0) depth--;
+      }
     }
   }
 }
 
 //******************************************************************************
 
-// Report a running average of performance data
+// Time each thread's share of the work in a parallel region, under the
+// innermost running timer.  Called by every thread, around a "for nowait"
+// loop, so that time spent waiting for other threads is not counted
+inline void timer_thread_start()
+{
+  if (TIMERS && thread_start != NULL) {
+    int tid = omp_get_thread_num();
+    if (tid < nthread_slots) thread_start[tid] = omp_get_wtime();
+  }
+}
+
+inline void timer_thread_stop()
+{
+  if (TIMERS && thread_times != NULL && depth > 0) {
+    int tid = omp_get_thread_num();
+    int code = stack[depth];
+    if (tid < nthread_slots)
+      thread_times[NODE(parent[code], code)*nthread_slots + tid] += omp_get_wtime() - thread_start[tid];
+  }
+}
+
+//******************************************************************************
+
+
+// Timer tree statistics over ranks: per-step min/mean/max of each node, and
+// the worst ratio of the busiest thread to the average one
+static double node_min[NNODE], node_mean[NNODE], node_max[NNODE], node_imbalance[NNODE];
+
+// Visit the children of timer "code", depth first, calling visit() on the way
+// down (enter = 1) and on the way back up (enter = 0).  Codes already on the
+// path are skipped, should timers have nested both ways round
+typedef void (*node_visitor)(FILE *fp, int node, int code, const char *path, int level, int last, int enter);
+static void walk_nodes(FILE *fp, int code, const char *path, int level, int *on_path, node_visitor visit)
+{
+  int children[NUM_TIMERS], nchild = 0;
+  for (int c = 0; c < NUM_TIMERS; c++) {
+    if (node_max[NODE(code, c)] > 0. && timer_name(c) != NULL && !on_path[c])
+      children[nchild++] = c;
+  }
+  for (int n = 0; n < nchild; n++) {
+    int c = children[n], last = (n == nchild - 1);
+    char child_path[STRLEN];
+    snprintf(child_path, STRLEN, "%s%s%s", path, (level > 0) ? "/" : "", timer_name(c));
+    visit(fp, NODE(code, c), c, child_path, level, last, 1);
+    on_path[c] = 1;
+    walk_nodes(fp, c, child_path, level + 1, on_path, visit);
+    on_path[c] = 0;
+    visit(fp, NODE(code, c), c, child_path, level, last, 0);
+  }
+}
+
+static void walk_tree(FILE *fp, node_visitor visit)
+{
+  int on_path[NUM_TIMERS] = {0};
+  walk_nodes(fp, NO_TIMER, "", 0, on_path, visit);
+}
+
+static void print_node(FILE *fp, int node, int code, const char *path, int level, int last, int enter)
+{
+  if (!enter) return;
+  double all = node_mean[NODE(NO_TIMER, TIMER_ALL)];
+  char label[64];
+  snprintf(label, 64, "%*s%s", 2*level, "", timer_name(code));
+  for (char *c = label; *c; c++) *c = toupper(*c);
+  fprintf(fp, "   %-22s %10.4g s %10.4g s %7.3g %%", label, node_mean[node], node_max[node],
+          (all > 0.) ? 100.*node_mean[node]/all : 0.);
+  if (node_imbalance[node] > 0.) fprintf(fp, "   threads %.3g", node_imbalance[node]);
+  fprintf(fp, "\n");
+}
+
+static void csv_node(FILE *fp, int node, int code, const char *path, int level, int last, int enter)
+{
+  if (!enter) return;
+  fprintf(fp, "%.8g,%d,%s,%d,%.6g,%.6g,%.6g,%.6g\n", t, nstep, path, level,
+          node_min[node], node_mean[node], node_max[node], node_imbalance[node]);
+}
+
+static void json_node(FILE *fp, int node, int code, const char *path, int level, int last, int enter)
+{
+  if (enter) {
+    fprintf(fp, "%*s\"%s\": {\"min\": %.6g, \"mean\": %.6g, \"max\": %.6g, \"thread_imbalance\": %.6g, \"children\": {\n",
+            2*level + 4, "", timer_name(code), node_min[node], node_mean[node], node_max[node], node_imbalance[node]);
+  } else {
+    fprintf(fp, "%*s}}%s\n", 2*level + 4, "", last ? "" : ",");
+  }
+}
+
+// Reduce the tree over ranks.  Collective
+static void reduce_nodes(int steps)
+{
+  static double per_step[NNODE], imbalance[NNODE];
+  for (int n = 0; n < NNODE; n++) {
+    per_step[n] = node_times[n]/steps;
+
+    // Busiest thread against the average, where threads were timed
+    double tmax = 0., tsum = 0.;
+    int nactive = 0;
+    for (int tid = 0; tid < nthread_slots; tid++) {
+      double tt = thread_times[n*nthread_slots + tid];
+      tmax = MY_MAX(tmax, tt);
+      tsum += tt;
+      if (tt > 0.) nactive++;
+    }
+    imbalance[n] = (tsum > 0.) ? tmax/(tsum/nactive) : 0.;
+  }
+  mpi_min_vector(per_step, node_min, NNODE);
+  mpi_max_vector(per_step, node_max, NNODE);
+  mpi_reduce_vector(per_step, node_mean, NNODE);
+  mpi_max_vector(imbalance, node_imbalance, NNODE);
+  for (int n = 0; n < NNODE; n++) node_mean[n] /= mpi_nprocs();
+}
+
+// Report a running average of performance data: the timer tree, per step, as
+// the mean and max over ranks, to stdout and to dumps/timers.json, and appended
+// to dumps/timers.csv
 void report_performance()
 {
+  int steps = nstep - nstep_start;
+  reduce_nodes(steps);
+
   if (mpi_io_proc()) {
-    int steps = nstep - nstep_start;
-#if TIMERS
     fprintf(stdout, "\n********** PERFORMANCE **********\n");
-    fprintf(stdout, "   RECON:    %8.4g s (%.4g %%)\n",
-      times[TIMER_RECON]/steps, 100.*times[TIMER_RECON]/times[TIMER_ALL]);
-    fprintf(stdout, "   LR_TO_F:  %8.4g s (%.4g %%)\n",
-      times[TIMER_LR_TO_F]/steps, 100.*times[TIMER_LR_TO_F]/times[TIMER_ALL]);
-    fprintf(stdout, "   CMAX:     %8.4g s (%.4g %%)\n",
-      times[TIMER_CMAX]/steps, 100.*times[TIMER_CMAX]/times[TIMER_ALL]);
-    fprintf(stdout, "   FLUX_CT:  %8.4g s (%.4g %%)\n",
-      times[TIMER_FLUX_CT]/steps, 100.*times[TIMER_FLUX_CT]/times[TIMER_ALL]);
-    fprintf(stdout, "   UPDATE_U: %8.4g s (%.4g %%)\n",
-      times[TIMER_UPDATE_U]/steps, 100.*times[TIMER_UPDATE_U]/times[TIMER_ALL]);
-    fprintf(stdout, "   U_TO_P:   %8.4g s (%.4g %%)\n",
-      times[TIMER_U_TO_P]/steps, 100.*times[TIMER_U_TO_P]/times[TIMER_ALL]);
-    fprintf(stdout, "   FIXUP:    %8.4g s (%.4g %%)\n",
-      times[TIMER_FIXUP]/steps, 100.*times[TIMER_FIXUP]/times[TIMER_ALL]);
-    fprintf(stdout, "   BOUND:    %8.4g s (%.4g %%)\n",
-      times[TIMER_BOUND]/steps, 100.*times[TIMER_BOUND]/times[TIMER_ALL]);
-    fprintf(stdout, "   BOUND_COMMS:    %8.4g s (%.4g %%)\n",
-      times[TIMER_BOUND_COMMS]/steps, 100.*times[TIMER_BOUND_COMMS]/times[TIMER_ALL]);
-    fprintf(stdout, "   DIAG:     %8.4g s (%.4g %%)\n",
-      times[TIMER_DIAG]/steps, 100.*times[TIMER_DIAG]/times[TIMER_ALL]);
-    fprintf(stdout, "   IO:     %8.4g s (%.4g %%)\n",
-      times[TIMER_IO]/steps, 100.*times[TIMER_IO]/times[TIMER_ALL]);
-    fprintf(stdout, "   RESTART:     %8.4g s (%.4g %%)\n",
-      times[TIMER_RESTART]/steps, 100.*times[TIMER_RESTART]/times[TIMER_ALL]);
-    fprintf(stdout, "   CURRENT:     %8.4g s (%.4g %%)\n",
-      times[TIMER_CURRENT]/steps, 100.*times[TIMER_CURRENT]/times[TIMER_ALL]);
-    fprintf(stdout, "   LR_STATE:     %8.4g s (%.4g %%)\n",
-      times[TIMER_LR_STATE]/steps, 100.*times[TIMER_LR_STATE]/times[TIMER_ALL]);
-    fprintf(stdout, "   LR_PTOF:     %8.4g s (%.4g %%)\n",
-      times[TIMER_LR_PTOF]/steps, 100.*times[TIMER_LR_PTOF]/times[TIMER_ALL]);
-    fprintf(stdout, "   LR_VCHAR:     %8.4g s (%.4g %%)\n",
-      times[TIMER_LR_VCHAR]/steps, 100.*times[TIMER_LR_VCHAR]/times[TIMER_ALL]);
-    fprintf(stdout, "   LR_CMAX:     %8.4g s (%.4g %%)\n",
-      times[TIMER_LR_CMAX]/steps, 100.*times[TIMER_LR_CMAX]/times[TIMER_ALL]);
-    fprintf(stdout, "   LR_FLUX:     %8.4g s (%.4g %%)\n",
-      times[TIMER_LR_FLUX]/steps, 100.*times[TIMER_LR_FLUX]/times[TIMER_ALL]);
-#if ELECTRONS
-    fprintf(stdout, "   E_HEAT:   %8.4g s (%.4g %%)\n",
-      times[TIMER_ELECTRON_HEAT]/steps,
-      100.*times[TIMER_ELECTRON_HEAT]/times[TIMER_ALL]);
-    fprintf(stdout, "   E_FIXUP:  %8.4g s (%.4g %%)\n",
-      times[TIMER_ELECTRON_FIXUP]/steps,
-      100.*times[TIMER_ELECTRON_FIXUP]/times[TIMER_ALL]);
-#endif
-#if COOLING
-    fprintf(stdout, "   COOLING:     %8.4g s (%.4g %%)\n",
-      times[TIMER_COOLING]/steps, 100.*times[TIMER_COOLING]/times[TIMER_ALL]);
-#endif
-#if POSITRONS && PAIRS
-    fprintf(stdout, "   PAIRS:     %8.4g s (%.4g %%)\n",
-      times[TIMER_POSITRON]/steps, 100.*times[TIMER_POSITRON]/times[TIMER_ALL]);
-#endif 
-#endif
+    fprintf(stdout, "   %-22s %12s %12s %9s\n", "", "MEAN", "MAX", "OF ALL");
+    walk_tree(stdout, print_node);
+
+    FILE *fp = fopen("dumps/timers.json", "w");
+    if (fp != NULL) {
+      fprintf(fp, "{\n  \"t\": %.8g,\n  \"nstep\": %d,\n  \"steps\": %d,\n", t, nstep, steps);
+      fprintf(fp, "  \"nranks\": %d,\n  \"nthreads\": %d,\n  \"timers\": {\n", mpi_nprocs(), nthreads);
+      walk_tree(fp, json_node);
+      fprintf(fp, "  }\n}\n");
+      fclose(fp);
+    }
 
-    // overall performances
-    fprintf(stdout, "   ALL:      %8.4g s\n", times[TIMER_ALL]/steps);
+    fp = fopen("dumps/timers.csv", "a");
+    if (fp != NULL) {
+      if (ftell(fp) == 0) fprintf(fp, "t,nstep,timer,depth,min,mean,max,thread_imbalance\n");
+      walk_tree(fp, csv_node);
+      fclose(fp);
+    }
+
+    // overall performances, at the pace of the slowest rank
+    double all = node_max[NODE(NO_TIMER, TIMER_ALL)];
     fprintf(stdout, "   ZONE CYCLES PER\n");
     fprintf(stdout, "     CORE-SECOND: %e\n",
-      N1TOT*N2TOT*N3TOT/(times[TIMER_ALL]*mpi_nprocs()*nthreads/steps));
+      N1TOT*N2TOT*N3TOT/(all*mpi_nprocs()*nthreads));
     fprintf(stdout, "     NODE-SECOND: %e\n",
-      N1TOT*N2TOT*N3TOT/(times[TIMER_ALL]*mpi_nprocs()/steps));
+      N1TOT*N2TOT*N3TOT/(all*mpi_nprocs()));
     fprintf(stdout, "          SECOND: %e\n",
-          N1TOT*N2TOT*N3TOT/(times[TIMER_ALL]/steps));
+          N1TOT*N2TOT*N3TOT/all);
+  }
+
+#if PERF_COUNTERS
+  counter_report(times, steps);
+#endif
+}
+
+//******************************************************************************
+
+// Short names of the timers, for machine-readable reports
+const char *timer_name(int timerCode)
+{
+  switch (timerCode) {
+    case TIMER_RECON: return "recon";
+    case TIMER_LR_TO_F: return "lr_to_f";
+    case TIMER_CMAX: return "cmax";
+    case TIMER_FLUX_CT: return "flux_ct";
+    case TIMER_UPDATE_U: return "update_u";
+    case TIMER_U_TO_P: return "u_to_p";
+    case TIMER_FIXUP: return "fixup";
+    case TIMER_FIXUP_UTOP: return "fixup_utop";
+    case TIMER_BOUND: return "bound";
+    case TIMER_BOUND_COMMS: return "bound_comms";
+    case TIMER_DIAG: return "diag";
+    case TIMER_LR_STATE: return "lr_state";
+    case TIMER_LR_PTOF: return "lr_ptof";
+    case TIMER_LR_VCHAR: return "lr_vchar";
+    case TIMER_LR_CMAX: return "lr_cmax";
+    case TIMER_LR_FLUX: return "lr_flux";
+    case TIMER_IO: return "io";
+    case TIMER_RESTART: return "restart";
+    case TIMER_CURRENT: return "current";
+    case TIMER_ALL: return "all";
+#if ELECTRONS
+    case TIMER_ELECTRON_FIXUP: return "e_fixup";
+    case TIMER_ELECTRON_HEAT: return "e_heat";
+#endif
+#if POSITRONS || COOLING
+    case TIMER_COOLING: return "cooling";
+    case TIMER_POSITRON: return "pairs";
+#endif
+    default: return NULL;
+  }
+}
+
+//******************************************************************************
+
+// Summarize a benchmark run: min/mean/max over ranks of each timer, per step,
+// to benchmark.json, and append a row to benchmark.csv.
+// Parallel efficiency is zone-cycles per core-second relative to the first row
+// of benchmark.csv, so running a series of core counts in one directory builds
+// up a strong (fixed NiTOT) or weak (fixed N1,N2,N3) scaling curve
+void report_benchmark()
+{
+  int steps = nstep - nstep_start;
+  int nprocs = mpi_nprocs();
+
+  double per_step[NUM_TIMERS], tmin[NUM_TIMERS], tmax[NUM_TIMERS], tmean[NUM_TIMERS];
+  for (int n = 0; n < NUM_TIMERS; n++) per_step[n] = times[n]/steps;
+  mpi_min_vector(per_step, tmin, NUM_TIMERS);
+  mpi_max_vector(per_step, tmax, NUM_TIMERS);
+  mpi_reduce_vector(per_step, tmean, NUM_TIMERS);
+  for (int n = 0; n < NUM_TIMERS; n++) tmean[n] /= nprocs;
+
+  // Every rank takes every step, so the slowest sets the pace
+  double zcps = N1TOT*N2TOT*N3TOT/tmax[TIMER_ALL];
+  double zcps_core = zcps/(nprocs*nthreads);
+
+  // Imbalance: time spent outside of neighbor communication
+  double work = per_step[TIMER_ALL] - per_step[TIMER_BOUND_COMMS];
+  double load_balance = mpi_reduce(work)/nprocs/mpi_max(work);
+
+  if (!mpi_io_proc()) return;
+
+#ifdef PROB_NAME
+  const char *problem = QUOTE(PROB_NAME);
+#else
+  const char *problem = "unknown";
+#endif
+
+  // Reference throughput from the first run in the table, if any
+  double zcps_core_ref = zcps_core;
+  int new_table = 1;
+  FILE *csv = fopen("benchmark.csv", "r");
+  if (csv != NULL) {
+    char header[4*STRLEN], row[4*STRLEN];
+    if (fgets(header, 4*STRLEN, csv) != NULL && fgets(row, 4*STRLEN, csv) != NULL) {
+      new_table = 0;
+      int col = -1, n = 0;
+      for (char *tok = strtok(header, ",\n"); tok != NULL; tok = strtok(NULL, ",\n"), n++)
+        if (strcmp(tok, "zcps_per_core") == 0) col = n;
+      n = 0;
+      for (char *tok = strtok(row, ",\n"); tok != NULL; tok = strtok(NULL, ",\n"), n++)
+        if (n == col) zcps_core_ref = atof(tok);
+    }
+    fclose(csv);
   }
+  double efficiency = zcps_core/zcps_core_ref;
+
+  FILE *fp = fopen("benchmark.json", "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Could not write benchmark.json!\n");
+    exit(-1);
+  }
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"problem\": \"%s\",\n", problem);
+  fprintf(fp, "  \"git_version\": \"%s\",\n", QUOTE(GIT_VERSION));
+  fprintf(fp, "  \"n1tot\": %d, \"n2tot\": %d, \"n3tot\": %d,\n", N1TOT, N2TOT, N3TOT);
+  fprintf(fp, "  \"n1cpu\": %d, \"n2cpu\": %d, \"n3cpu\": %d,\n", N1CPU, N2CPU, N3CPU);
+  fprintf(fp, "  \"nranks\": %d,\n", nprocs);
+  fprintf(fp, "  \"nthreads\": %d,\n", nthreads);
+  fprintf(fp, "  \"steps\": %d,\n", steps);
+  fprintf(fp, "  \"zcps\": %.8g,\n", zcps);
+  fprintf(fp, "  \"zcps_per_core\": %.8g,\n", zcps_core);
+  fprintf(fp, "  \"zcps_per_core_reference\": %.8g,\n", zcps_core_ref);
+  fprintf(fp, "  \"parallel_efficiency\": %.6g,\n", efficiency);
+  fprintf(fp, "  \"load_balance\": %.6g,\n", load_balance);
+  fprintf(fp, "  \"timers\": {");
+  int first = 1;
+  for (int n = 0; n < NUM_TIMERS; n++) {
+    if (timer_name(n) == NULL) continue;
+    fprintf(fp, "%s\n    \"%s\": {\"min\": %.6g, \"mean\": %.6g, \"max\": %.6g}",
+            first ? "" : ",", timer_name(n), tmin[n], tmean[n], tmax[n]);
+    first = 0;
+  }
+  fprintf(fp, "\n  }\n}\n");
+  fclose(fp);
+
+  csv = fopen("benchmark.csv", "a");
+  if (csv == NULL) {
+    fprintf(stderr, "Could not write benchmark.csv!\n");
+    exit(-1);
+  }
+  if (new_table) {
+    fprintf(csv, "problem,n1tot,n2tot,n3tot,nranks,nthreads,steps,zcps,zcps_per_core,parallel_efficiency,load_balance");
+    for (int n = 0; n < NUM_TIMERS; n++) {
+      if (timer_name(n) == NULL) continue;
+      fprintf(csv, ",%s_min,%s_mean,%s_max", timer_name(n), timer_name(n), timer_name(n));
+    }
+    fprintf(csv, "\n");
+  }
+  fprintf(csv, "%s,%d,%d,%d,%d,%d,%d,%.8g,%.8g,%.6g,%.6g", problem, N1TOT, N2TOT, N3TOT,
+          nprocs, nthreads, steps, zcps, zcps_core, efficiency, load_balance);
+  for (int n = 0; n < NUM_TIMERS; n++) {
+    if (timer_name(n) == NULL) continue;
+    fprintf(csv, ",%.6g,%.6g,%.6g", tmin[n], tmean[n], tmax[n]);
+  }
+  fprintf(csv, "\n");
+  fclose(csv);
+
+  fprintf(stdout, "\n********** BENCHMARK **********\n");
+  fprintf(stdout, "   STEPS:      %d\n", steps);
+  fprintf(stdout, "   ZONE CYCLES PER SECOND:      %e\n", zcps);
+  fprintf(stdout, "   ZONE CYCLES PER CORE-SECOND: %e\n", zcps_core);
+  fprintf(stdout, "   PARALLEL EFFICIENCY:         %.4g\n", efficiency);
+  fprintf(stdout, "   LOAD BALANCE:                %.4g\n", load_balance);
+  fprintf(stdout, "   Wrote benchmark.json, benchmark.csv\n");
+}
+
+//******************************************************************************
+
+// Overwrite status.json with the run's progress and its performance since the
+// last call: timers per step, mean over ranks, and rates at the pace of the
+// slowest rank.  Written to a temporary file and renamed into place, so that
+// monitors never see it half written.  Collective
+void report_status()
+{
+  int steps = nstep - status_nstep;
+  if (steps <= 0) return;
+  double now = omp_get_wtime();
+
+  double per_step[NUM_TIMERS], tmean[NUM_TIMERS];
+  for (int n = 0; n < NUM_TIMERS; n++) {
+    per_step[n] = (times[n] - status_times[n])/steps;
+    status_times[n] = times[n];
+  }
+  mpi_reduce_vector(per_step, tmean, NUM_TIMERS);
+
+  double wall = mpi_max(now - status_wall);
+  double fails = mpi_reduce(nfail_utop);
+  double floors = mpi_reduce(nfloor_hit);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double rss = usage.ru_maxrss/1024.; // kB on Linux
+  double rss_max = mpi_max(rss), rss_tot = mpi_reduce(rss);
+
+  double steps_per_sec = (wall > 0.) ? steps/wall : 0.;
+  double zcps = (double) N1TOT*N2TOT*N3TOT*steps_per_sec;
+  double t_left = (t > status_t && t < tf) ? (tf - t)*wall/(t - status_t) : 0.;
+  double t_start = status_t;
+
+  status_wall = now;
+  status_t = t;
+  status_nstep = nstep;
+  nfail_utop = nfloor_hit = 0;
+
+  if (!mpi_io_proc()) return;
+
+  FILE *fp = fopen("status.json.tmp", "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Could not write status.json!\n");
+    return;
+  }
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"updated\": %ld,\n", (long int) time(NULL));
+  fprintf(fp, "  \"run_seconds\": %.6g,\n", now - run_start);
+  fprintf(fp, "  \"t\": %.10g,\n  \"dt\": %.6g,\n  \"tf\": %.10g,\n", t, dt, tf);
+  fprintf(fp, "  \"nstep\": %d,\n", nstep);
+  fprintf(fp, "  \"interval\": {\"steps\": %d, \"seconds\": %.6g, \"t_start\": %.10g},\n",
+          steps, wall, t_start);
+  fprintf(fp, "  \"steps_per_second\": %.6g,\n", steps_per_sec);
+  fprintf(fp, "  \"zcps\": %.6g,\n", zcps);
+  fprintf(fp, "  \"eta_seconds\": %.6g,\n", t_left);
+  fprintf(fp, "  \"utop_failures\": %.0f,\n", fails);
+  fprintf(fp, "  \"floor_hits\": %.0f,\n", floors);
+  fprintf(fp, "  \"max_rss_mb\": {\"max\": %.6g, \"total\": %.6g},\n", rss_max, rss_tot);
+  fprintf(fp, "  \"nranks\": %d,\n  \"nthreads\": %d,\n", mpi_nprocs(), nthreads);
+  fprintf(fp, "  \"timers\": {");
+  int first = 1;
+  for (int n = 0; n < NUM_TIMERS; n++) {
+    if (timer_name(n) == NULL || tmean[n] <= 0.) continue;
+    fprintf(fp, "%s\n    \"%s\": %.6g", first ? "" : ",", timer_name(n), tmean[n]/mpi_nprocs());
+    first = 0;
+  }
+  fprintf(fp, "\n  }\n}\n");
+  fclose(fp);
+
+  if (rename("status.json.tmp", "status.json") != 0)
+    fprintf(stderr, "Could not move status.json into place!\n");
 }
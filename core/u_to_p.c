@@ -167,6 +167,11 @@ int U_to_P(struct GridGeom *G, struct FluidState *S, int i, int j, int k, int lo
     }
   }
 
+#if ZONE_STATS
+  // Halley step, then secant steps
+  zone_stats[ZS_UTOP_ITER][k][j][i] += 1 + MY_MIN(iter + 1, ITERMAX);
+#endif
+
   // Failure to converge; do not set primitives other than B
   if(iter == ITERMAX) {
     return(1);